@@ -5,6 +5,12 @@
 #include <string.h> // needed by str functions
 #include <ctype.h>  // needed by isdigit, etc.
 #include <time.h>   // needed by asctime
+#include <pthread.h> // needed by parallel lexing
+#include <unistd.h>  // needed by fork, close, etc.
+#include <signal.h>  // needed by signal
+#include <sys/socket.h>  // needed by compile server
+#include <sys/un.h>      // needed by sockaddr_un
+#include <limits.h>      // needed by INT_MIN
 
 // Constants
 
@@ -15,7 +21,17 @@
 
 // Sizes for arrays
 #define MAX 180            // size of string arrays
-#define SYMTABSIZE 1000    // symbol table size
+#define SYMTABSIZE 1024    // initial symbol table size
+#define PROFSIZE 1000      // loop profile table size
+#define MAXJOBS 64         // max lexer and code generator threads
+#define CODEGENGROUP 512   // min top-level statements per codegen task
+#define PARALLELMIN (1 << 20)  // min source bytes for --jobs
+#define STACKLIMIT 1000    // default max operand stack depth
+#define STACKOPS 24        // instructions in the stack effect table
+
+// Profile-guided unrolling
+#define HOTLOOP 100        // min body executions before unrolling
+#define MAXUNROLL 4        // max copies of a loop body
 
 #define END 0
 #define PRINTLN 1
@@ -42,6 +58,10 @@
 #define COMMA 22
 #define REPEAT 23
 
+// Expression tree node kinds with no token of their own
+#define NEG 24             // unary minus
+#define CONST 25           // constant made by fold
+
 
 time_t timer;    // for asctime
 
@@ -49,9 +69,13 @@ time_t timer;    // for asctime
 // Function definition or prototype must
 // precede function call so compiler can
 // check for correct type, number of args
-void expr(void);
+struct nodetype *expr(void);
 void printArg(void);
-void assignmentTail();
+struct nodetype *assignmentTail(void);
+void emitProfileDump(void);
+void endCCode(void);
+void emitStackDirective(void);
+void assignSlots(int *slot);
 
 // Global Variables
 
@@ -84,12 +108,96 @@ char *tokenImage[24] =
   "\"repeat\""
 };
 
-char inFileName[MAX], outFileName[MAX], inputLine[MAX];
+char inFileName[MAX], outFileName[MAX];
 int debug = FALSE;
+int streaming = FALSE;      // TRUE when compiling stdin to stdout
+int extTarget = FALSE;      // TRUE for --target=ext
+int emitC = FALSE;          // TRUE for --emit=c
+int jobs = 1;               // threads, set by --jobs
 
+// Compile server (--serve).  Each request is compiled in a child
+// process, which collects its code and messages in memory and
+// sends them back over the socket in one reply.
+int serving = FALSE;        // TRUE in a compile server child
+int replyFd;                // socket to send the reply on
+char *codeText, *msgText;   // code and messages for the reply
+size_t codeSize, msgSize;
 
-char *symbol[SYMTABSIZE];     // symbol table
+
+// The symbol table doubles when it fills, and so do the arrays
+// indexed like it.  symbolRoom is how many entries this thread's
+// arrays hold (see makeSymbolRoom).
+char **symbol;                // symbol table
 int symbolx;                  // index into symbol table
+int symbolSize;               // entries allocated
+int *symbolHash;              // 1 + index of symbol, 0 if empty
+unsigned symbolHashSize;      // 2 * symbolSize
+_Thread_local int symbolRoom;
+
+// With --emit=c the variables are declared before main, but they
+// are not all known until the end, so the body of main is built
+// in memory and written out after them by endCCode.
+FILE *cFile;                  // the real output file
+char *cBody;                  // body of main
+size_t cBodySize;
+_Thread_local int cDepth;     // loops around the C being emitted
+
+// Code generation state is thread local so that with --jobs
+// groups of top-level statements are generated on several threads.
+
+// Constant propagation state, indexed like symbol.  known[i] is
+// TRUE when symbol[i] is sure to hold value[i] at the point in
+// the code being generated.  Every variable starts out as dw 0.
+_Thread_local int *known, *value;
+
+// A while loop is first parsed with dryRun set, which turns off
+// code generation and instead marks in assigned every variable
+// the loop stores into.  Those are unknown at the loop's top.
+_Thread_local int dryRun = FALSE;
+_Thread_local char *assigned;
+_Thread_local int labelCount;   // next label number for getLabel
+
+// silent turns off output but, unlike dryRun, keeps the labels
+// and constant state up to date.  The program is parsed silently
+// once before the code is generated in parallel.  The stack and
+// storage analysis is left to the codegen threads.
+_Thread_local int silent = FALSE;
+
+// Operand stack analysis (see trackStack).  stackDepth is the
+// depth after the code emitted so far, and labelDepth[n] is 1 +
+// the depth at label @Ln, or 0 if no jump to it or label has been
+// seen yet.  The deepest point goes into the ;#stack directive,
+// which compile makes room for at offset stackDirective.
+int stackLimit = STACKLIMIT;        // set by --stack-limit
+long stackDirective = -1;           // -1 if written at the end
+_Thread_local int stackDepth, maxStackDepth;
+_Thread_local int maxInOrderDepth;  // same, without schedule
+_Thread_local int *labelDepth, labelDepthSize;
+
+// Storage coalescing (see assignSlots).  Each symbol is live
+// from the first to the last instruction that uses it, counted
+// by codePosition, or from the start if it may be read before the
+// code stores into it.  A loop that a live range overlaps is
+// added to the range whole.  Symbols whose ranges do not overlap
+// share a dw.  pendingStore holds the symbols whose address pc
+// has pushed, until stav stores into them.
+_Thread_local int codePosition;
+_Thread_local int *firstUse, *lastUse;
+_Thread_local char *fromStart, *stored;
+_Thread_local int *pendingStore, pendingx, pendingSize;
+_Thread_local int *loopStart, *loopEnd, loopx, loopSize;
+_Thread_local int loopDepth;       // loops around the code
+
+// Loop profile table, one entry per while loop, keyed by the
+// line and column of its "while" token.  With --instrument the
+// entries hold the names of each loop's hidden counters.  With
+// --profile they hold the counts read from the profile file.
+int instrument = FALSE;
+char *profileName = NULL;
+int profLine[PROFSIZE], profColumn[PROFSIZE];
+char *profEntryCounter[PROFSIZE], *profBodyCounter[PROFSIZE];
+long profEntries[PROFSIZE], profIterations[PROFSIZE];
+int profx;                    // index into profile table
 
 //create new type named TOKEN
 typedef struct tokentype
@@ -97,23 +205,201 @@ typedef struct tokentype
    int kind;
    int beginLine, beginColumn, endLine, endColumn;
    char *image;
+   int traced;          // TRUE once shown by debug_token_manager
    struct tokentype *next;
 } TOKEN;
 
+//create new type named NODE for expression trees
+typedef struct nodetype
+{
+   int kind;            // UNSIGNED, ID, ASSIGN, NEG, or operator
+   char *image;         // literal or variable name
+   int index;           // symbol table index of variable
+   int known, value;    // set by fold: is the value a constant?
+   int need, inOrder;   // set by schedule: stack entries needed
+   TOKEN *start;        // first token of an expression
+   struct nodetype *left, *right;
+} NODE;
+
+//create new type named COMMENT for output comments that wait
+//until the parser reaches their line
+typedef struct commenttype
+{
+   int line;
+   char *text;
+   struct commenttype *next;
+} COMMENT;
+
+
+FILE *inFile;               // file pointers
+_Thread_local FILE *outFile;  // a memory buffer in codegen threads
+FILE *msgFile;              // banner and error messages
+
+// Tokenizer state.  Thread local so that with --jobs each lexer
+// thread runs getNextToken on its own chunk of the source.
+_Thread_local int currentChar = '\n';
+_Thread_local int currentColumnNumber;
+_Thread_local int currentLineNumber;
+_Thread_local char inputLine[MAX];
+_Thread_local int inString;           // TRUE inside "..."
+_Thread_local char *inText, *inTextEnd;  // chunk, if not inFile
+_Thread_local COMMENT *commentHead, *commentTail;  // comment queue
+_Thread_local TOKEN *currentToken;
+_Thread_local TOKEN *previousToken;
+
+// Tokens from parallel lexing, one array per chunk, handed to
+// the parser in order by nextToken
+//create new type named CHUNK
+typedef struct chunktype
+{
+   char *text, *textEnd;     // source of this chunk
+   int last;                 // TRUE for the final chunk
+   TOKEN *tokens;            // token array
+   int tokenx, tokenSize;    // tokens used, allocated
+   int lines;                // lines in chunk
+   COMMENT *commentHead, *commentTail;
+} CHUNK;
+CHUNK chunk[MAXJOBS];
+int chunkCount;               // 0 unless lexed in parallel
+int chunkx, chunkTokenx;      // next token for nextToken
+
+// Parallel code generation.  The top-level statements are cut
+// into groups of CODEGENGROUP.  The silent pass records where
+// each group starts and the state there.  A codegen thread then
+// generates each group into its own buffer, and the buffers are
+// written out in order.
+//create new type named GROUP
+typedef struct grouptype
+{
+   TOKEN *start, *previous;  // first token, token before it
+   TOKEN *end;               // first token after the group
+   int labelCount;           // labels used before the group
+   int symbols;              // symbols entered before the group
+   int *known, *value;       // constant state at the start
+   COMMENT *commentHead, *commentTail;  // comments to output
+   char *text;               // generated code
+   size_t size;
+   int maxStackDepth, maxInOrderDepth;  // deepest in the group
+   int positions;            // instructions (see codePosition)
+   int *firstUse, *lastUse;  // storage use, from group start
+   char *fromStart, *stored;
+   int *loopStart, *loopEnd, loops;
+   TOKEN *tooDeep;           // first expression over stackLimit
+} GROUP;
+GROUP *group;
+_Thread_local GROUP *currentGroup;  // group of a codegen thread
+int groupx, groupSize;        // groups used, allocated
+int nextGroup;                // next group for a codegen thread
+pthread_mutex_t groupLock = PTHREAD_MUTEX_INITIALIZER;
+
+//-----------------------------------------
+// Queue a comment for the output file.  Source lines and the
+// token trace are read ahead of code generation (a while loop
+// reads its whole body before generating any of it), so they
+// are held here until advance reaches their line.
+void queueComment(int line, char *text)
+{
+   COMMENT *c;
+
+   c = (COMMENT *)malloc(sizeof(COMMENT));
+   c -> line = line;
+   c -> text = strdup(text);
+   c -> next = NULL;
+   if (commentTail)
+      commentTail -> next = c;
+   else
+      commentHead = c;
+   commentTail = c;
+}
+//-----------------------------------------
+// Make text into one comment line of the output in buffer, which
+// needs room for 6 more chars.  gcc joins a line that ends in a
+// backslash, even with spaces or a CR after it, or in the trigraph
+// ?\?/ under -std=c99, to the next.  So a C comment (--emit=c) is
+// trimmed, and one that still ends in either is ended with "//".
+void makeComment(char *buffer, char *text)
+{
+   int n;
+
+   sprintf(buffer, "%s%s", emitC ? "// " : "; ", text);
+   if (!emitC)
+      return;
+   n = strlen(buffer);
+   while (n > 2 && isspace((unsigned char)buffer[n - 1]))
+      n--;
+   if (buffer[n - 1] == '\\' ||
+      (n >= 3 && !strncmp(buffer + n - 3, "?\?/", 3)))
+      strcpy(buffer + n, " //\n");
+   else
+      strcpy(buffer + n, "\n");
+}
+//-----------------------------------------
+// output queued comments for lines up to and including line
+void echoComments(int line)
+{
+   COMMENT *c;
 
-FILE *inFile, *outFile;     // file pointers
+   while (commentHead && commentHead -> line <= line)
+   {
+      c = commentHead;
+      fputs(c -> text, outFile);
+      commentHead = c -> next;
+      if (!commentHead)
+         commentTail = NULL;
+      free(c -> text);
+      free(c);
+   }
+}
 
-int currentChar = '\n';
-int currentColumnNumber;
-int currentLineNumber;
-TOKEN *currentToken;
-TOKEN *previousToken;
+//-----------------------------------------
+// write all n bytes of buffer to fd
+void writeAll(int fd, char *buffer, size_t n)
+{
+   ssize_t written;
+   while (n > 0)
+   {
+      written = write(fd, buffer, n);
+      if (written <= 0)
+         return;
+      buffer += written;
+      n -= written;
+   }
+}
+//-----------------------------------------
+// Send the reply to a compile server request and end the child:
+//   <status> <code bytes> <message bytes>\n<code><messages>
+// status is 0 if the compile ended without error, 1 if not.
+void finishRequest(int status)
+{
+   char header[64];
+   int n;
 
+   fclose(outFile);
+   fclose(msgFile);
+   n = sprintf(header, "%d %lu %lu\n", status,
+      (unsigned long)codeSize, (unsigned long)msgSize);
+   writeAll(replyFd, header, n);
+   writeAll(replyFd, codeText, codeSize);
+   writeAll(replyFd, msgText, msgSize);
+   close(replyFd);
+   exit(status);
+}
+//-----------------------------------------
+// Exit after an error.  A compile server child sends its reply.
+void quit(void)
+{
+   if (serving)
+      finishRequest(1);
+   exit(1);
+}
 //-----------------------------------------
 // Abnormal end.
 // Close files so DRCompiler.a has max info for debugging
 void abend(void)
 {
+   echoComments(currentLineNumber);
+   if (serving)
+      finishRequest(1);
    fclose(inFile);
    fclose(outFile);
    exit(1);
@@ -121,32 +407,116 @@ void abend(void)
 //-----------------------------------------
 void displayErrorLoc(void)
 {
-    printf("Error on line %d column %d\n", currentToken ->
+    fprintf(msgFile, "Error on line %d column %d\n", currentToken ->
        beginLine, currentToken -> beginColumn);
 }
 //-----------------------------------------
 // enter symbol into symbol table if not already there
-void enter(char *s)
+// returns its index
+//
+// symbolHash finds a symbol without a search of the whole table.
+// New symbols are only entered while one thread is running (the
+// silent pass enters them all before parallel code generation),
+// so lookups from the codegen threads need no lock.
+// symbolHash slot that holds s, or the empty one where s goes
+unsigned symbolSlot(char *s)
+{
+   unsigned h = 5381;
+   char *c;
+
+   for (c = s; *c; c++)
+      h = h * 33 + (unsigned char)*c;
+   h %= symbolHashSize;
+   while (symbolHash[h] && strcmp(s, symbol[symbolHash[h] - 1]))
+      h = (h + 1) % symbolHashSize;
+   return h;
+}
+//-----------------------------------------
+// index of s in the symbol table, or -1 if it is not there
+int lookup(char *s)
+{
+   return symbolHash[symbolSlot(s)] - 1;
+}
+//-----------------------------------------
+// double the symbol table and rehash it
+void growSymbols(void)
+{
+   int i;
+
+   symbolSize = symbolSize ? 2 * symbolSize : SYMTABSIZE;
+   symbol = (char **)realloc(symbol, symbolSize * sizeof(char *));
+   free(symbolHash);
+   symbolHashSize = 2 * symbolSize;
+   symbolHash = (int *)calloc(symbolHashSize, sizeof(int));
+   for (i = 0; i < symbolx; i++)
+      symbolHash[symbolSlot(symbol[i])] = i + 1;
+}
+//-----------------------------------------
+// Make room for n symbols in this thread's arrays indexed like
+// symbol.  New entries are 0, but firstUse is -1.
+void makeSymbolRoom(int n)
 {
-   int i = 0;
-   while (i < symbolx)
+   int old = symbolRoom, i;
+
+   if (n <= symbolRoom)
+      return;
+   symbolRoom = n > 2 * old ? n : 2 * old;
+   known = (int *)realloc(known, symbolRoom * sizeof(int));
+   value = (int *)realloc(value, symbolRoom * sizeof(int));
+   firstUse = (int *)realloc(firstUse, symbolRoom * sizeof(int));
+   lastUse = (int *)realloc(lastUse, symbolRoom * sizeof(int));
+   assigned = (char *)realloc(assigned, symbolRoom);
+   fromStart = (char *)realloc(fromStart, symbolRoom);
+   stored = (char *)realloc(stored, symbolRoom);
+   for (i = old; i < symbolRoom; i++)
    {
-      if (!strcmp(s, symbol[i]))
-         break;
-      i++;
+      known[i] = value[i] = lastUse[i] = 0;
+      firstUse[i] = -1;
+      assigned[i] = fromStart[i] = stored[i] = FALSE;
    }
+}
+//-----------------------------------------
+int enter(char *s)
+{
+   unsigned h = symbolSlot(s);
+
+   if (symbolHash[h])
+      return symbolHash[h] - 1;
 
    // if s is not in symbol table, then add it
 
-   if (i == symbolx){
-      if (symbolx < SYMTABSIZE)
-        symbol[symbolx++] = s;
-      else
-      {
-         printf("System error: symbol table overflow\n");
-         abend();
-      }
+   if (symbolx == symbolSize)
+   {
+      growSymbols();
+      h = symbolSlot(s);
    }
+   makeSymbolRoom(symbolx + 1);
+   known[symbolx] = TRUE;     // dw 0
+   value[symbolx] = 0;
+   firstUse[symbolx] = -1;
+   symbolHash[h] = symbolx + 1;
+   symbol[symbolx] = s;
+   return symbolx++;
+}
+//-----------------------------------------
+// Read the next source line into inputLine like fgets, from
+// inFile or from the in-memory chunk.  Returns FALSE at end.
+int readLine(void)
+{
+    int n = 0;
+
+    if (!inText)
+      return fgets(inputLine, sizeof(inputLine), inFile) != NULL;
+    if (inText == inTextEnd)
+      return FALSE;
+    while (inText < inTextEnd && n < MAX - 1)
+    {
+      inputLine[n++] = *inText;
+      if (*inText++ == '\n')
+        break;
+    }
+    inputLine[n] = '\0';
+    return TRUE;
 }
 //-----------------------------------------
 void getNextChar(void)
@@ -156,13 +526,21 @@ void getNextChar(void)
 
     if (currentChar == '\n')        // need next line?
     {
-      // fgets returns 0 (false) on EOF
-      if (fgets(inputLine, sizeof(inputLine), inFile))
+      // When streaming, push out the code for everything read so
+      // far before blocking on the pipe for more source.
+      if (streaming)
+        fflush(outFile);
+
+      // readLine returns 0 (false) on EOF
+      if (readLine())
       {
+        char comment[MAX + 8];
+
         // output source line as comment
-        fprintf(outFile, "; %s", inputLine);
         currentColumnNumber = 0;
         currentLineNumber++;
+        makeComment(comment, inputLine);
+        queueComment(currentLineNumber, comment);
       }
       else  // at end of file
       {
@@ -176,7 +554,7 @@ void getNextChar(void)
 
     // in DRCompiler, test for single-line comment goes here
     if(sizeof(inputLine)> currentColumnNumber ){
-		if(currentChar=='/' && inputLine[currentColumnNumber]=='/' && currentToken-> kind !=STRING){
+		if(currentChar=='/' && inputLine[currentColumnNumber]=='/' && !inString){
 			currentChar='\n';
 		}
     }
@@ -185,7 +563,7 @@ void getNextChar(void)
 // This function is tokenizer (aka lexical analyzer, scanner)
 TOKEN *getNextToken(void)
 {
-    char buffer[80];    // buffer to build image
+    char buffer[MAX];   // buffer to build image
     int bufferx = 0;    // index into buffer
     TOKEN *t;	        // will point to taken struct
 
@@ -230,27 +608,33 @@ TOKEN *getNextToken(void)
     }
     else
     if(currentChar=='"'){
-      currentToken -> kind = STRING;
+      inString = TRUE;
 	  do
 	  {
 		buffer[bufferx++] = currentChar;
 		t -> endLine = currentLineNumber;
 		t -> endColumn = currentColumnNumber;
 		getNextChar();
-		//if(currentChar == '\n' || currentChar == '\r'){
-			//t -> kind= ERROR;
-			//break;
-		//}
-	  }while(currentChar != '"');
+	  }while(currentChar != '"' && currentChar != '\n' &&
+		currentChar != END);
+      inString = FALSE;
 
-	  buffer[bufferx++] = '"';
-	  buffer[bufferx++] = '\0';
-	  t -> kind = STRING;
-	  t -> endLine = currentLineNumber;
-	  t -> endColumn = currentColumnNumber;
-	  t -> image = strdup(buffer);
+	  // a string must end on the line it starts on
+	  if(currentChar != '"'){
+		buffer[bufferx] = '\0';
+		t -> kind = ERROR;
+		t -> image = strdup(buffer);
+	  }
+	  else{
+		buffer[bufferx++] = '"';
+		buffer[bufferx++] = '\0';
+		t -> kind = STRING;
+		t -> endLine = currentLineNumber;
+		t -> endColumn = currentColumnNumber;
+		t -> image = strdup(buffer);
 
-	  getNextChar();
+		getNextChar();
+	  }
     }
 
     else  // check for identifier
@@ -341,16 +725,125 @@ TOKEN *getNextToken(void)
 
       getNextChar();  // read beyond end of token
     }
-    // token trace appears as comments in output file
+    t -> traced = FALSE;
+    return t;     // return token to parser
+}
+//-----------------------------------------
+// Lexer thread: tokenize one chunk into its token array.  Line
+// numbers are relative to the chunk until lexParallel fixes them.
+void *lexChunk(void *arg)
+{
+    CHUNK *c = (CHUNK *)arg;
+    TOKEN *t;
 
-    // set debug to true to check tokenizer
-    if (debug)
-      fprintf(outFile,
-        "; kind=%3d beginLine=%3d beginColumn=%3d endLine=%3d endColumn=%3d     im=%s\n",
-        t -> kind, t -> beginLine, t -> beginColumn,
-        t -> endLine, t -> endColumn, t -> image);
+    inText = c -> text;
+    inTextEnd = c -> textEnd;
+    do
+    {
+      t = getNextToken();
+      if (c -> tokenx == c -> tokenSize)
+      {
+        c -> tokenSize = c -> tokenSize ? 2 * c -> tokenSize : 1024;
+        c -> tokens = (TOKEN *)realloc(c -> tokens,
+           c -> tokenSize * sizeof(TOKEN));
+      }
+      c -> tokens[c -> tokenx++] = *t;
+      free(t);
+    } while (c -> tokens[c -> tokenx - 1].kind != END);
 
-    return t;     // return token to parser
+    // only the final chunk ends the token stream
+    if (!c -> last)
+      c -> tokenx--;
+    c -> lines = currentLineNumber;
+    c -> commentHead = commentHead;
+    c -> commentTail = commentTail;
+    return NULL;
+}
+//-----------------------------------------
+// Tokenize the whole input file on jobs threads.  Strings and
+// comments never cross a line, so the file is split into chunks
+// at newlines and each chunk is lexed on its own.  A prefix sum
+// of the chunk line counts then gives each chunk's first line.
+void lexParallel(void)
+{
+    char *text;
+    long size = 0, allocated = 1 << 16, n;
+    long start, end;
+    int i, j, lineOffset;
+    pthread_t thread[MAXJOBS];
+    COMMENT *cm;
+
+    text = (char *)malloc(allocated);
+    while ((n = fread(text + size, 1, allocated - size, inFile)) > 0)
+    {
+      size += n;
+      if (size == allocated)
+      {
+        allocated *= 2;
+        text = (char *)realloc(text, allocated);
+      }
+    }
+
+    // a small file is lexed and generated on one thread
+    chunkCount = size < PARALLELMIN ? 1 : jobs;
+    start = 0;
+    for (i = 0; i < chunkCount; i++)
+    {
+      end = (i == chunkCount - 1) ? size : size * (i + 1) / chunkCount;
+      if (end < start)
+        end = start;
+      while (end < size && end > 0 && text[end - 1] != '\n')
+        end++;
+      chunk[i].text = text + start;
+      chunk[i].textEnd = text + end;
+      chunk[i].last = (i == chunkCount - 1);
+      if (pthread_create(&thread[i], NULL, lexChunk, &chunk[i]))
+      {
+        fprintf(msgFile, "System error: cannot create thread\n");
+        abend();
+      }
+      start = end;
+    }
+
+    lineOffset = 0;
+    for (i = 0; i < chunkCount; i++)
+    {
+      pthread_join(thread[i], NULL);
+      for (j = 0; j < chunk[i].tokenx; j++)
+      {
+        chunk[i].tokens[j].beginLine += lineOffset;
+        chunk[i].tokens[j].endLine += lineOffset;
+      }
+      for (cm = chunk[i].commentHead; cm; cm = cm -> next)
+        cm -> line += lineOffset;
+
+      // append chunk's comments to the queue
+      if (chunk[i].commentHead)
+      {
+        if (commentTail)
+          commentTail -> next = chunk[i].commentHead;
+        else
+          commentHead = chunk[i].commentHead;
+        commentTail = chunk[i].commentTail;
+      }
+      lineOffset += chunk[i].lines;
+    }
+    currentLineNumber = lineOffset;   // for abend
+}
+//-----------------------------------------
+// next token for the parser, from the chunk token arrays if the
+// file was lexed in parallel, otherwise from the tokenizer
+TOKEN *nextToken(void)
+{
+    if (!chunkCount)
+      return getNextToken();
+
+    while (chunkTokenx == chunk[chunkx].tokenx)
+    {
+      chunkx++;
+      chunkTokenx = 0;
+    }
+    return &chunk[chunkx].tokens[chunkTokenx++];
 }
 //-----------------------------------------
 //
@@ -359,12 +852,12 @@ TOKEN *getNextToken(void)
 void advance(void)
 {
     static int firstTime = TRUE;
-
+    char trace[MAX + 100], comment[MAX + 106];
 
     if (firstTime)
     {
        firstTime = FALSE;
-       currentToken = getNextToken();
+       currentToken = nextToken();
     }
     else
     {
@@ -378,7 +871,27 @@ void advance(void)
        // put it on the list.
        else
          currentToken = (currentToken -> next) =
-            getNextToken();
+            nextToken();
+    }
+
+    if (dryRun || silent)
+       return;
+
+    // source lines are output as the parser reaches them
+    echoComments(currentToken -> beginLine);
+
+    // token trace appears as comments in output file
+    // set debug to true to check tokenizer
+    if (debug && !currentToken -> traced)
+    {
+       currentToken -> traced = TRUE;
+       sprintf(trace,
+         "kind=%3d beginLine=%3d beginColumn=%3d endLine=%3d endColumn=%3d     im=%s\n",
+         currentToken -> kind, currentToken -> beginLine,
+         currentToken -> beginColumn, currentToken -> endLine,
+         currentToken -> endColumn, currentToken -> image);
+       makeComment(comment, trace);
+       fputs(comment, outFile);
     }
 }
 //-----------------------------------------
@@ -393,7 +906,7 @@ void consume(int expected)
     else
     {
        displayErrorLoc();
-       printf("Scanning %s, expecting %s\n",
+       fprintf(msgFile, "Scanning %s, expecting %s\n",
           currentToken -> image, tokenImage[expected]);
        abend();
     }
@@ -421,14 +934,196 @@ TOKEN *getToken(int i)
       // Otherwise, get next token from token mgr and
       // put it on the list.
       else
-        t = (t -> next) = getNextToken();
+        t = (t -> next) = nextToken();
     }
     return t;
 }
 //-----------------------------------------
+// Stack effect of each instruction: the entries it takes off the
+// operand stack, and the entries it puts back.
+char *stackOp[STACKOPS] =
+{
+  "pwc", "p", "pc", "stav", "add", "sub", "mult", "div", "neg",
+  "dupe", "rot", "jz", "ja", "din", "dout", "aout", "sout", "halt",
+  "inc", "dec", "addi", "stk", "jeq", "swap"
+};
+int stackIn[STACKOPS] =
+  {0, 0, 0, 2, 2, 2, 2, 2, 1, 1, 3, 1, 0, 0, 1, 1, 1, 0, 0, 0, 0, 1, 0, 0};
+int stackOut[STACKOPS] =
+  {1, 1, 1, 0, 1, 1, 1, 1, 1, 2, 3, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0};
+//-----------------------------------------
+// check that the stack is as deep at label as at every other
+// jump to it or definition of it
+void checkLabelDepth(char *label)
+{
+    int n = atoi(label + 2), oldSize = labelDepthSize;
+
+    if (n >= labelDepthSize)
+    {
+       labelDepthSize = 2 * n + 64;
+       labelDepth = (int *)realloc(labelDepth,
+          labelDepthSize * sizeof(int));
+       memset(labelDepth + oldSize, 0,
+          (labelDepthSize - oldSize) * sizeof(int));
+    }
+    if (labelDepth[n] == 0)
+       labelDepth[n] = stackDepth + 1;
+    else if (labelDepth[n] != stackDepth + 1)
+    {
+       fprintf(msgFile,
+          "System error: operand stack unbalanced at %s\n", label);
+       abend();
+    }
+}
+//-----------------------------------------
+// Reject the expression at token t, which needs more than
+// stackLimit operand stack entries.  A codegen thread only notes
+// the first one in its group, so that parallelStatementList can
+// report the first in the program.
+void stackTooDeep(TOKEN *t)
+{
+    if (currentGroup)
+    {
+       if (!currentGroup -> tooDeep)
+          currentGroup -> tooDeep = t;
+       return;
+    }
+    currentToken = t;
+    displayErrorLoc();
+    fprintf(msgFile,
+       "Expression needs more than %d operand stack entries\n",
+       stackLimit);
+    abend();
+}
+//-----------------------------------------
+// Follow the operand stack depth through instruction op, whose
+// operand is opnd.  noteInOrder rejects an expression that would
+// need more than stackLimit entries before its code is emitted;
+// any other code that would is rejected here.
+void trackStack(char *op, char *opnd)
+{
+    char name[8];
+    int i;
+
+    sscanf(op, "%7s", name);
+    for (i = 0; i < STACKOPS; i++)
+       if (!strcmp(name, stackOp[i]))
+          break;
+    if (i == STACKOPS || stackDepth < stackIn[i])
+    {
+       fprintf(msgFile, "System error: operand stack underflow at %s\n",
+          name);
+       abend();
+    }
+    stackDepth += stackOut[i] - stackIn[i];
+    if (stackDepth > maxStackDepth)
+    {
+       maxStackDepth = stackDepth;
+       if (maxStackDepth > stackLimit)
+          stackTooDeep(currentToken);
+    }
+    if (!strcmp(name, "jz") || !strcmp(name, "ja"))
+       checkLabelDepth(opnd);
+    else if (!strcmp(name, "jeq"))
+       checkLabelDepth(strrchr(opnd, ',') + 1);
+}
+//-----------------------------------------
+// record that the current instruction uses symbol i
+void noteUse(int i)
+{
+    if (firstUse[i] < 0)
+       firstUse[i] = codePosition;
+    lastUse[i] = codePosition;
+}
+//-----------------------------------------
+// record that the current instruction reads symbol i
+void noteRead(int i)
+{
+    noteUse(i);
+    if (!stored[i])            // may still hold its dw 0
+       fromStart[i] = TRUE;
+}
+//-----------------------------------------
+// Record that the current instruction stores into symbol i.  A
+// store outside any loop is sure to happen before the code that
+// follows it.
+void noteStore(int i)
+{
+    noteUse(i);
+    if (loopDepth == 0)
+       stored[i] = TRUE;
+}
+//-----------------------------------------
+// Follow the reads and stores of symbols through instruction op,
+// whose operand is opnd, for storage coalescing.
+void trackStorage(char *op, char *opnd)
+{
+    char name[8], temp[MAX * 2], *field;
+    int i, j;
+
+    sscanf(op, "%7s", name);
+    strcpy(temp, opnd);
+    field = strchr(temp, ',');
+    if (field)
+       *field++ = '\0';
+    i = lookup(temp);
+
+    if (!strcmp(name, "pc") && i >= 0)
+    {
+       noteUse(i);
+       if (pendingx == pendingSize)
+       {
+          pendingSize = pendingSize ? 2 * pendingSize : 16;
+          pendingStore = (int *)realloc(pendingStore,
+             pendingSize * sizeof(int));
+       }
+       pendingStore[pendingx++] = i;
+    }
+    else if (!strcmp(name, "stav") && pendingx > 0)
+       noteStore(pendingStore[--pendingx]);
+    else if (!strcmp(name, "stk"))
+       noteStore(i);
+    else if (!strcmp(name, "p") || !strcmp(name, "jeq"))
+       noteRead(i);
+    else if (!strcmp(name, "inc") || !strcmp(name, "dec") ||
+       !strcmp(name, "addi"))
+    {
+       noteRead(i);
+       noteStore(i);
+    }
+    else if (!strcmp(name, "swap"))
+    {
+       j = lookup(field);
+       noteRead(i);
+       noteRead(j);
+       noteStore(i);
+       noteStore(j);
+    }
+    codePosition++;
+}
+//-----------------------------------------
+// record a loop from code position start to end
+void noteLoop(int start, int end)
+{
+    if (loopx == loopSize)
+    {
+       loopSize = loopSize ? 2 * loopSize : 64;
+       loopStart = (int *)realloc(loopStart, loopSize * sizeof(int));
+       loopEnd = (int *)realloc(loopEnd, loopSize * sizeof(int));
+    }
+    loopStart[loopx] = start;
+    loopEnd[loopx++] = end;
+}
+//-----------------------------------------
+// The stack machine emitters below output nothing for --emit=c,
+// which has its own (see emitCText).
 // emit one-operand instruction
 void emitInstruction1(char *op)
 {
+    if (dryRun || silent || emitC)
+       return;
+    trackStack(op, "");
+    trackStorage(op, "");
     fprintf(outFile, "          %-4s\n", op);
 }
 //-----------------------------------------
@@ -436,6 +1131,10 @@ void emitInstruction1(char *op)
 // function overloading not supported by C
 void emitInstruction2(char *op, char *opnd)
 {
+    if (dryRun || silent || emitC)
+       return;
+    trackStack(op, opnd);
+    trackStorage(op, opnd);
     fprintf(outFile,
        "          %-4s      %s\n", op,opnd);
 }
@@ -443,6 +1142,8 @@ void emitInstruction2(char *op, char *opnd)
 void emitdw(char *label, char *value)
 {
     char temp[80];
+    if (dryRun || silent || emitC)
+       return;
     strcpy(temp, label);
     strcat(temp, ":");
 
@@ -452,112 +1153,889 @@ void emitdw(char *label, char *value)
 //-----------------------------------------
 void endCode(void)
 {
-    int i;
+    int i, j, last, *slot;
+    char *done;
+    if (emitC)
+    {
+       endCCode();
+       return;
+    }
+    if (instrument)
+       emitProfileDump();
     emitInstruction1("\n          halt\n");
 
-    // emit dw for each symbol in the symbol table
+    // emit a dw for each storage slot, labelled with each symbol
+    // that shares it
+    slot = (int *)malloc(symbolx * sizeof(int) + 1);
+    done = (char *)calloc(symbolx + 1, 1);
+    assignSlots(slot);
     for (i=0; i < symbolx; i++)
-       emitdw(symbol[i], "0");
+    {
+       if (done[slot[i]])
+          continue;
+       done[slot[i]] = TRUE;
+       last = i;
+       for (j = i + 1; j < symbolx; j++)
+          if (slot[j] == slot[i])
+          {
+             fprintf(outFile, "%s:\n", symbol[last]);
+             last = j;
+          }
+       emitdw(symbol[last], "0");
+    }
+    free(slot);
+    free(done);
+    emitStackDirective();
+    if (maxInOrderDepth > maxStackDepth)
+       fprintf(msgFile,
+          "Operand reordering cut the stack depth from %d to %d\n",
+          maxInOrderDepth, maxStackDepth);
+}
+//-----------------------------------------
+// Give each symbol a storage slot in slot[i].  Symbols share a
+// slot if their live ranges (see codePosition) do not overlap.
+// The ranges are taken in order of their start and each one
+// goes in the first slot that is free by then.  A symbol the code
+// never uses can go in any slot.
+void assignSlots(int *slot)
+{
+    int *start, *end, *order, *slotEnd;
+    int i, k, l, s, slots = 0, changed;
+
+    start = (int *)malloc(symbolx * sizeof(int) + 1);
+    end = (int *)malloc(symbolx * sizeof(int) + 1);
+    order = (int *)malloc(symbolx * sizeof(int) + 1);
+    slotEnd = (int *)malloc(symbolx * sizeof(int) + 1);
+    for (i = 0; i < symbolx; i++)
+    {
+       start[i] = fromStart[i] ? 0 : firstUse[i];
+       end[i] = lastUse[i];
+    }
+
+    // a value live anywhere in a loop may be needed all through it
+    do
+    {
+       changed = FALSE;
+       for (i = 0; i < symbolx; i++)
+          for (l = 0; firstUse[i] >= 0 && l < loopx; l++)
+             if (start[i] <= loopEnd[l] && end[i] >= loopStart[l] &&
+                (start[i] > loopStart[l] || end[i] < loopEnd[l]))
+             {
+                if (start[i] > loopStart[l])
+                   start[i] = loopStart[l];
+                if (end[i] < loopEnd[l])
+                   end[i] = loopEnd[l];
+                changed = TRUE;
+             }
+    } while (changed);
+
+    // used symbols in order of start (insertion sort)
+    k = 0;
+    for (i = 0; i < symbolx; i++)
+       if (firstUse[i] >= 0)
+       {
+          for (l = k++; l > 0 && start[order[l - 1]] > start[i]; l--)
+             order[l] = order[l - 1];
+          order[l] = i;
+       }
+
+    for (l = 0; l < k; l++)
+    {
+       i = order[l];
+       for (s = 0; s < slots && slotEnd[s] >= start[i]; s++)
+          ;
+       if (s == slots)
+          slots++;
+       slot[i] = s;
+       slotEnd[s] = end[i];
+    }
+    for (i = 0; i < symbolx; i++)
+       if (firstUse[i] < 0)
+          slot[i] = slots ? 0 : slots++;
+
+    free(start);
+    free(end);
+    free(order);
+    free(slotEnd);
+}
+//-----------------------------------------
+// Write the ;#stack directive, which gives the most entries the
+// operand stack holds, so a runtime can size its stack up front.
+// It goes in the place compile kept for it in the header, or at
+// the end if the output cannot be rewound (a pipe or a compile
+// server reply).
+void emitStackDirective(void)
+{
+    if (stackDirective >= 0 && !fseek(outFile, stackDirective, SEEK_SET))
+    {
+       fprintf(outFile, ";#stack %-10d\n", maxStackDepth);
+       fseek(outFile, 0, SEEK_END);
+    }
+    else
+       fprintf(outFile, ";#stack %d\n", maxStackDepth);
 }
 //-----------------------------------------
 char* getLabel(void)
 {
-   static int count = 0;
-   char lbuf[10];
-   sprintf(lbuf, "@L%d", count++);  // "prints" to lbuf
+   char lbuf[16];
+   sprintf(lbuf, "@L%d", labelCount++);  // "prints" to lbuf
    return strdup(lbuf);   // returns label in its own storage area
 }
 //-----------------------------------------
 void emitLabel(char *label){
+	if (dryRun || silent || emitC)
+		return;
+	checkLabelDepth(label);
 	fprintf(outFile,
 	       "%s:\n", label);
 }
 //-----------------------------------------
-void factor(void)
+// emit code that adds 1 to the hidden counter label
+void emitIncrement(char *label)
 {
-    TOKEN *t;
-    switch(currentToken -> kind)
+    if (extTarget)
     {
-      case UNSIGNED:
-        t = currentToken;
-        consume(UNSIGNED);
-        emitInstruction2("pwc", t -> image);
-        break;
-      case ID:
-		t = currentToken;
-		consume(ID);
-		enter(t -> image);
-		emitInstruction2("p", t -> image);
-		break;
-      case PLUS:
-    	consume(PLUS);
-    	t = currentToken;
-        factor();
-        break;
-      case LEFTPAREN:
-		consume(LEFTPAREN);
-		expr();
-		consume(RIGHTPAREN);
-		break;
-      case MINUS:
-        consume(MINUS);
-        switch(currentToken->kind){
-			case UNSIGNED:
-				t = currentToken;
-				consume(UNSIGNED);
-				emitInstruction2("pwc", t -> image);
-				emitInstruction1("neg");
-				break;
-			case ID:
-				t = currentToken;
-				consume(ID);
-				enter(t -> image);
-				emitInstruction2("p", t -> image);
-				emitInstruction1("neg");
-				break;
-			case LEFTPAREN:
-				consume(LEFTPAREN);
-				expr();
-				consume(RIGHTPAREN);
-				emitInstruction1("neg");
-				break;
-			case PLUS:
-				consume(PLUS);
-				factor();
-				emitInstruction1("neg");
-				break;
-			case MINUS:
-				consume(MINUS);
-				factor();
-				break;
-			default:
-				break;
-			}
-        break;
-      default:
-        displayErrorLoc();
-        printf("Scanning %s, expecting factor\n", currentToken ->
-           image);
-        abend();
+       emitInstruction2("inc", label);
+       return;
     }
+    emitInstruction2("pc", label);
+    emitInstruction2("p", label);
+    emitInstruction2("pwc", "1");
+    emitInstruction1("add");
+    emitInstruction1("stav");
 }
 //-----------------------------------------
-void factorList(void)
+// emit code that prints one profile line per instrumented loop:
+//   @prof while <line> <column> <entries> <iterations>
+// --profile skips any other lines, so the program's whole output
+// can be saved as the profile file.  The lines start with a
+// newline, as the program's last line may be unfinished.
+void emitProfileDump(void)
 {
-    switch(currentToken -> kind)
+    int i;
+    char *label;
+    char temp[MAX], image[MAX];
+
+    if (profx > 0)
     {
-      case TIMES:
-        consume(TIMES);
-        factor();
-        emitInstruction1("mult");
-        factorList();
-        break;
-      case DIVIDE:
-        consume(DIVIDE);
-        factor();
-        emitInstruction1("div");
-        factorList();
-        break;
+       emitInstruction2("pc", "'\\n'");
+       emitInstruction1("aout");
+    }
+    for (i = 0; i < profx; i++)
+    {
+       label = getLabel();
+       emitInstruction2("pc", label);
+       emitInstruction1("sout");
+       sprintf(temp, "^%s", label);
+       sprintf(image, "\"@prof while %d %d \"", profLine[i],
+          profColumn[i]);
+       emitdw(temp, image);
+       emitInstruction2("p", profEntryCounter[i]);
+       emitInstruction1("dout");
+       emitInstruction2("pc", "' '");
+       emitInstruction1("aout");
+       emitInstruction2("p", profBodyCounter[i]);
+       emitInstruction1("dout");
+       emitInstruction2("pc", "'\\n'");
+       emitInstruction1("aout");
+    }
+}
+//-----------------------------------------
+// read the @prof lines of a profile file into the profile table
+void readProfile(char *name)
+{
+    FILE *f;
+    char line[MAX], *record;
+    int lineNumber, column;
+    long entries, iterations;
+
+    f = fopen(name, "r");
+    if (!f)
+    {
+       fprintf(msgFile, "Error: Cannot open %s\n", name);
+       quit();
+    }
+    while (fgets(line, sizeof(line), f))
+    {
+       record = strstr(line, "@prof while ");
+       if (!record || sscanf(record, "@prof while %d %d %ld %ld",
+             &lineNumber, &column, &entries, &iterations) != 4)
+          continue;
+       if (profx == PROFSIZE)
+       {
+          fprintf(msgFile, "System error: profile table overflow\n");
+          quit();
+       }
+       profLine[profx] = lineNumber;
+       profColumn[profx] = column;
+       profEntries[profx] = entries;
+       profIterations[profx] = iterations;
+       profx++;
+    }
+    fclose(f);
+}
+//-----------------------------------------
+// Number of copies of the body to emit for the while loop at
+// line/column.  Each extra copy repeats the test and saves one
+// "ja" back to the top, so only loops that the profile shows
+// run hot, with several trips per entry, are unrolled.
+int unrollFactor(int line, int column)
+{
+    int i, factor;
+    long trips;
+
+    for (i = 0; i < profx; i++)
+       if (profLine[i] == line && profColumn[i] == column)
+          break;
+    if (i == profx || profEntries[i] == 0 ||
+          profIterations[i] < HOTLOOP)
+       return 1;
+
+    trips = profIterations[i] / profEntries[i];
+    for (factor = MAXUNROLL; factor > 1; factor /= 2)
+       if (trips >= 2 * factor)
+          return factor;
+    return 1;
+}
+//-----------------------------------------
+NODE *makeNode(int kind, char *image, NODE *left, NODE *right)
+{
+    NODE *p;
+    p = (NODE *)malloc(sizeof(NODE));
+    p -> kind = kind;
+    p -> image = image;
+    p -> index = -1;
+    p -> known = FALSE;
+    p -> value = 0;
+    p -> start = NULL;
+    p -> left = left;
+    p -> right = right;
+    return p;
+}
+//-----------------------------------------
+// record a store into variable i for constant propagation
+void setVariable(int i, int isKnown, int v)
+{
+    if (dryRun)
+       assigned[i] = TRUE;
+    else
+    {
+       known[i] = isKnown;
+       value[i] = v;
+    }
+}
+//-----------------------------------------
+// mark the n variables in list as unknown
+void forget(int *list, int n)
+{
+    int i;
+    for (i = 0; i < n; i++)
+       known[list[i]] = FALSE;
+}
+//-----------------------------------------
+// For + and *, which wrap and so can be regrouped freely, move a
+// constant operand to the right, and turn (x op c1) op c2 into
+// x op (c1 op c2) so that the constants fold together.  p is not
+// constant, and its operands are already done.
+void reassociate(NODE *p)
+{
+    NODE *t;
+    unsigned c1, c2;
+
+    if (p -> kind != PLUS && p -> kind != TIMES)
+       return;
+    if (p -> left -> known)
+    {
+       t = p -> left;
+       p -> left = p -> right;
+       p -> right = t;
+    }
+    t = p -> left;
+    if (t -> kind != p -> kind || !t -> right -> known ||
+       !p -> right -> known)
+       return;
+
+    c1 = (unsigned)t -> right -> value;
+    c2 = (unsigned)p -> right -> value;
+    p -> left = t -> left;
+    p -> right = makeNode(CONST, NULL, NULL, NULL);
+    p -> right -> known = TRUE;
+    p -> right -> value = (int)(p -> kind == PLUS ? c1 + c2 : c1 * c2);
+}
+//-----------------------------------------
+// Work out bottom-up which parts of the tree are constant, using
+// the values of the variables known at this point.  Arithmetic
+// wraps like the target's instead of overflowing the C int.
+void foldConstants(NODE *p)
+{
+    int l, r;
+
+    switch(p -> kind)
+    {
+      case CONST:
+        return;
+      case UNSIGNED:
+        p -> known = TRUE;
+        p -> value = atoi(p -> image);
+        return;
+      case ID:
+        p -> known = known[p -> index];
+        p -> value = value[p -> index];
+        return;
+      case ASSIGN:
+        foldConstants(p -> right);
+        p -> known = p -> right -> known;
+        p -> value = p -> right -> value;
+        return;
+      case NEG:
+        foldConstants(p -> left);
+        p -> known = p -> left -> known;
+        p -> value = (int)(0u - (unsigned)p -> left -> value);
+        return;
+    }
+
+    foldConstants(p -> left);
+    foldConstants(p -> right);
+    p -> known = p -> left -> known && p -> right -> known;
+    if (!p -> known)
+    {
+       reassociate(p);
+       return;
+    }
+    l = p -> left -> value;
+    r = p -> right -> value;
+    switch(p -> kind)
+    {
+      case PLUS:
+        p -> value = (int)((unsigned)l + (unsigned)r);
+        break;
+      case MINUS:
+        p -> value = (int)((unsigned)l - (unsigned)r);
+        break;
+      case TIMES:
+        p -> value = (int)((unsigned)l * (unsigned)r);
+        break;
+      case DIVIDE:
+        if (r == 0)                // leave it to run time
+           p -> known = FALSE;
+        else if (r == -1)
+           p -> value = (int)(0u - (unsigned)l);
+        else
+           p -> value = l / r;
+        break;
+    }
+}
+//-----------------------------------------
+// Sethi-Ullman ordering.  Set p -> need to the most entries the
+// code for p puts on the stack, and p -> inOrder to the most it
+// would put there evaluated left to right.  The operands of + and
+// * are swapped when the right one needs more, so that it goes
+// first while the stack is shallower.  Expressions have no side
+// effects (readint is a statement), and a division by zero ends
+// the run the same way whichever operand it is in, so operands
+// may be evaluated in either order.
+void schedule(NODE *p)
+{
+    NODE *t;
+
+    if (p -> kind == ASSIGN)
+    {
+       // pc x, value, dupe; or value, stk x with --target=ext
+       schedule(p -> right);
+       p -> need = p -> right -> need;
+       p -> inOrder = p -> right -> inOrder;
+       if (!extTarget)
+       {
+          p -> need = p -> need + 1 > 3 ? p -> need + 1 : 3;
+          p -> inOrder = p -> inOrder + 1 > 3 ? p -> inOrder + 1 : 3;
+       }
+       return;
+    }
+    if (p -> known || p -> kind == ID)
+    {
+       p -> need = p -> inOrder = 1;
+       return;
+    }
+    switch(p -> kind)
+    {
+      case NEG:
+        schedule(p -> left);
+        p -> need = p -> left -> need;
+        p -> inOrder = p -> left -> inOrder;
+        return;
+    }
+
+    schedule(p -> left);
+    schedule(p -> right);
+    p -> inOrder = p -> left -> inOrder > p -> right -> inOrder ?
+       p -> left -> inOrder : p -> right -> inOrder + 1;
+    if ((p -> kind == PLUS || p -> kind == TIMES) &&
+       p -> right -> need > p -> left -> need)
+    {
+       t = p -> left;
+       p -> left = p -> right;
+       p -> right = t;
+    }
+    p -> need = p -> left -> need > p -> right -> need ?
+       p -> left -> need : p -> right -> need + 1;
+}
+//-----------------------------------------
+// fold the constants in an expression tree, then order it
+void fold(NODE *p)
+{
+    foldConstants(p);
+    schedule(p);
+}
+//-----------------------------------------
+// Note how deep the stack would get if the folded tree p, whose
+// code starts here, were evaluated left to right, and reject it
+// here if its code as ordered would go over stackLimit.
+void noteInOrder(NODE *p)
+{
+    if (dryRun || silent || emitC)
+       return;
+    if (stackDepth + p -> need > stackLimit)
+       stackTooDeep(p -> start ? p -> start : currentToken);
+    if (stackDepth + p -> inOrder > maxInOrderDepth)
+       maxInOrderDepth = stackDepth + p -> inOrder;
+}
+//-----------------------------------------
+// If the folded tree p is an unknown variable plus or minus a
+// constant, return TRUE with the variable's index in *index and
+// the constant added to it in *c.
+int varPlusConstant(NODE *p, int *index, int *c)
+{
+    if (p -> known)
+       return FALSE;
+    switch(p -> kind)
+    {
+      case ID:
+        *index = p -> index;
+        *c = 0;
+        return TRUE;
+      case PLUS:
+        if (p -> left -> kind == ID && p -> right -> known)
+        {
+           *index = p -> left -> index;
+           *c = p -> right -> value;
+           return TRUE;
+        }
+        if (p -> right -> kind == ID && p -> left -> known)
+        {
+           *index = p -> right -> index;
+           *c = p -> left -> value;
+           return TRUE;
+        }
+        break;
+      case MINUS:
+        if (p -> left -> kind == ID && p -> right -> known)
+        {
+           *index = p -> left -> index;
+           *c = (int)(0u - (unsigned)p -> right -> value);
+           return TRUE;
+        }
+        break;
+    }
+    return FALSE;
+}
+//-----------------------------------------
+// emit code that pushes the constant v
+void emitConstant(int v)
+{
+    char temp[16];
+    if (v < 0)
+    {
+       sprintf(temp, "%u", 0u - (unsigned)v);
+       emitInstruction2("pwc", temp);
+       emitInstruction1("neg");
+    }
+    else
+    {
+       sprintf(temp, "%d", v);
+       emitInstruction2("pwc", temp);
+    }
+}
+//-----------------------------------------
+// emit code that pushes the value of variable i
+void emitVariable(int i)
+{
+    if (known[i])
+       emitConstant(value[i]);
+    else
+       emitInstruction2("p", symbol[i]);
+}
+//-----------------------------------------
+// emit code for a folded expression tree
+void emitExpr(NODE *p)
+{
+    if (p -> kind == ASSIGN && extTarget)
+    {
+       emitExpr(p -> right);
+       emitInstruction2("stk", p -> image);     // store and keep
+       setVariable(p -> index, p -> known, p -> value);
+       return;
+    }
+    if (p -> kind == ASSIGN)
+    {
+       emitInstruction2("pc", p -> image);
+       emitExpr(p -> right);
+       emitInstruction1("dupe");
+       emitInstruction1("rot");
+       emitInstruction1("stav");
+       setVariable(p -> index, p -> known, p -> value);
+       return;
+    }
+    if (p -> known)
+    {
+       emitConstant(p -> value);
+       return;
+    }
+
+    switch(p -> kind)
+    {
+      case ID:
+        emitInstruction2("p", p -> image);
+        break;
+      case NEG:
+        emitExpr(p -> left);
+        emitInstruction1("neg");
+        break;
+      case PLUS:
+        emitExpr(p -> left);
+        emitExpr(p -> right);
+        emitInstruction1("add");
+        break;
+      case MINUS:
+        emitExpr(p -> left);
+        emitExpr(p -> right);
+        emitInstruction1("sub");
+        break;
+      case TIMES:
+        emitExpr(p -> left);
+        emitExpr(p -> right);
+        emitInstruction1("mult");
+        break;
+      case DIVIDE:
+        emitExpr(p -> left);
+        emitExpr(p -> right);
+        emitInstruction1("div");
+        break;
+    }
+}
+//-----------------------------------------
+// fold an expression tree and emit its code
+void genExpr(NODE *p)
+{
+    fold(p);
+    noteInOrder(p);
+    emitExpr(p);
+}
+//-----------------------------------------
+// emit code that jumps to label if the folded tree p is zero
+// With --target=ext, var + c is tested by one compare-and-branch.
+void emitJumpIfZero(NODE *p, char *label)
+{
+    int i, c;
+    char temp[MAX * 2];
+
+    if (extTarget && varPlusConstant(p, &i, &c))
+    {
+       sprintf(temp, "%s,%d,%s", symbol[i], (int)(0u - (unsigned)c),
+          label);
+       emitInstruction2("jeq", temp);
+    }
+    else if (extTarget && p -> kind == MINUS && p -> left -> known &&
+       p -> right -> kind == ID && !p -> right -> known)
+    {
+       sprintf(temp, "%s,%d,%s", p -> right -> image,
+          p -> left -> value, label);
+       emitInstruction2("jeq", temp);
+    }
+    else
+    {
+       noteInOrder(p);
+       emitExpr(p);
+       emitInstruction2("jz", label);
+    }
+}
+//-----------------------------------------
+// emit code that adds the constant c to variable name in place
+// (--target=ext only)
+void emitAddImmediate(char *name, int c)
+{
+    char temp[MAX * 2];
+
+    if (c == 1)
+       emitInstruction2("inc", name);
+    else if (c == -1)
+       emitInstruction2("dec", name);
+    else if (c != 0)
+    {
+       sprintf(temp, "%s,%d", name, c);
+       emitInstruction2("addi", temp);
+    }
+}
+//-----------------------------------------
+// C backend (--emit=c).  The program becomes main, each variable
+// a global int, and each while loop a C while loop.  The helpers
+// in cPrelude keep the stack machine's arithmetic: it wraps, and
+// division by zero ends the run with an error as in DRInterp.
+char *cPrelude =
+   "#include <stdio.h>\n"
+   "#include <stdlib.h>\n"
+   "\n"
+   "static inline int dr_add(int a, int b)\n"
+   "{\n"
+   "   return (int)((unsigned)a + (unsigned)b);\n"
+   "}\n"
+   "static inline int dr_sub(int a, int b)\n"
+   "{\n"
+   "   return (int)((unsigned)a - (unsigned)b);\n"
+   "}\n"
+   "static inline int dr_mul(int a, int b)\n"
+   "{\n"
+   "   return (int)((unsigned)a * (unsigned)b);\n"
+   "}\n"
+   "static inline int dr_neg(int a)\n"
+   "{\n"
+   "   return (int)(0u - (unsigned)a);\n"
+   "}\n"
+   "static inline int dr_div(int a, int b)\n"
+   "{\n"
+   "   if (b == 0)\n"
+   "   {\n"
+   "      fprintf(stderr, \"Division by zero\\n\");\n"
+   "      exit(1);\n"
+   "   }\n"
+   "   return b == -1 ? dr_neg(a) : a / b;\n"
+   "}\n"
+   "static inline int dr_readint(void)\n"
+   "{\n"
+   "   int v;\n"
+   "   if (scanf(\"%d\", &v) != 1)\n"
+   "      v = 0;\n"
+   "   return v;\n"
+   "}\n"
+   "\n";
+//-----------------------------------------
+// write text to the C output
+void emitCText(char *text)
+{
+    if (dryRun || silent)
+       return;
+    fputs(text, outFile);
+}
+//-----------------------------------------
+// start a line of C, indented for the loops it is in
+void emitCIndent(void)
+{
+    if (dryRun || silent)
+       return;
+    fprintf(outFile, "%*s", 3 * (cDepth + 1), "");
+}
+//-----------------------------------------
+// write one line of C
+void emitCLine(char *text)
+{
+    emitCIndent();
+    emitCText(text);
+    emitCText("\n");
+}
+//-----------------------------------------
+// write the C name of variable name.  The prefix keeps it clear
+// of C keywords and library names.  Hidden variables, which
+// start with @, get their own prefix.
+void emitCName(char *name)
+{
+    if (dryRun || silent)
+       return;
+    if (*name == '@')
+       fprintf(outFile, "h_%s", name + 1);
+    else
+       fprintf(outFile, "v_%s", name);
+}
+//-----------------------------------------
+// write the constant v as a C int expression
+void emitCConstant(int v)
+{
+    char temp[24];
+
+    if (v == INT_MIN)
+       strcpy(temp, "(-2147483647 - 1)");
+    else if (v < 0)
+       sprintf(temp, "(%d)", v);
+    else
+       sprintf(temp, "%d", v);
+    emitCText(temp);
+}
+//-----------------------------------------
+// write a folded expression tree as a C expression
+void emitCExpr(NODE *p)
+{
+    char *helper;
+
+    if (p -> known)
+    {
+       emitCConstant(p -> value);
+       return;
+    }
+
+    switch(p -> kind)
+    {
+      case ID:
+        emitCName(p -> image);
+        return;
+      case NEG:
+        emitCText("dr_neg(");
+        emitCExpr(p -> left);
+        emitCText(")");
+        return;
+      case PLUS:
+        helper = "dr_add(";
+        break;
+      case MINUS:
+        helper = "dr_sub(";
+        break;
+      case TIMES:
+        helper = "dr_mul(";
+        break;
+      default:
+        // Dividing by a constant other than 0 or -1 cannot fail
+        // or overflow, and plain / lets the C compiler turn it
+        // into a multiply.
+        if (p -> right -> known && p -> right -> value != 0 &&
+           p -> right -> value != -1)
+        {
+           emitCText("(");
+           emitCExpr(p -> left);
+           emitCText(" / ");
+           emitCExpr(p -> right);
+           emitCText(")");
+           return;
+        }
+        helper = "dr_div(";
+        break;
+    }
+    emitCText(helper);
+    emitCExpr(p -> left);
+    emitCText(", ");
+    emitCExpr(p -> right);
+    emitCText(")");
+}
+//-----------------------------------------
+// Emit C for name = p, where p may be a chain of assignments.  C
+// may not store into a variable twice in one expression (a = a =
+// 5), so the chain becomes statements, innermost first.
+void emitCAssign(char *name, NODE *p)
+{
+    if (p -> kind == ASSIGN)
+    {
+       emitCAssign(p -> image, p -> right);
+       setVariable(p -> index, p -> known, p -> value);
+    }
+    emitCIndent();
+    emitCName(name);
+    emitCText(" = ");
+    if (p -> kind == ASSIGN)
+       emitCName(p -> image);
+    else
+       emitCExpr(p);
+    emitCText(";\n");
+}
+//-----------------------------------------
+// write the STRING token image as a C string literal.  The stack
+// machine prints every char as is, so backslashes are escaped,
+// and so is ? in case the C compiler reads trigraphs.
+void emitCString(char *image)
+{
+    char temp[2 * MAX + 3], *s;
+    int n = 0;
+
+    temp[n++] = '"';
+    for (s = image + 1; *s && *s != '"'; s++)
+    {
+       if (*s == '\\' || *s == '?')
+          temp[n++] = '\\';
+       temp[n++] = *s;
+    }
+    temp[n++] = '"';
+    temp[n] = '\0';
+    emitCText(temp);
+}
+//-----------------------------------------
+// End the C output: declare the variables, then write main with
+// the body generated into cBody.  Globals start at 0, as dw 0.
+void endCCode(void)
+{
+    int i;
+
+    fclose(outFile);
+    outFile = cFile;
+    cFile = NULL;
+    for (i = 0; i < symbolx; i++)
+    {
+       fputs("int ", outFile);
+       emitCName(symbol[i]);
+       fputs(";\n", outFile);
+    }
+    fputs("\nint main(void)\n{\n", outFile);
+    fwrite(cBody, 1, cBodySize, outFile);
+    fputs("   return 0;\n}\n", outFile);
+    free(cBody);
+}
+//-----------------------------------------
+NODE *factor(void)
+{
+    TOKEN *t;
+    NODE *p;
+    switch(currentToken -> kind)
+    {
+      case UNSIGNED:
+        t = currentToken;
+        consume(UNSIGNED);
+        return makeNode(UNSIGNED, t -> image, NULL, NULL);
+      case ID:
+		t = currentToken;
+		consume(ID);
+		p = makeNode(ID, t -> image, NULL, NULL);
+		p -> index = enter(t -> image);
+		return p;
+      case PLUS:
+    	consume(PLUS);
+        return factor();
+      case LEFTPAREN:
+		consume(LEFTPAREN);
+		p = expr();
+		consume(RIGHTPAREN);
+		return p;
+      case MINUS:
+        consume(MINUS);
+        switch(currentToken->kind){
+			case MINUS:
+				consume(MINUS);
+				return factor();
+			default:
+				return makeNode(NEG, "-", factor(), NULL);
+			}
+      default:
+        displayErrorLoc();
+        fprintf(msgFile, "Scanning %s, expecting factor\n", currentToken ->
+           image);
+        abend();
+    }
+    return NULL;
+}
+//-----------------------------------------
+NODE *factorList(NODE *left)
+{
+    switch(currentToken -> kind)
+    {
+      case TIMES:
+        consume(TIMES);
+        return factorList(makeNode(TIMES, "*", left, factor()));
+      case DIVIDE:
+        consume(DIVIDE);
+        return factorList(makeNode(DIVIDE, "/", left, factor()));
       case PLUS:
       case MINUS:
       case RIGHTPAREN:
@@ -566,84 +2044,104 @@ void factorList(void)
         break;
       default:
         displayErrorLoc();
-        printf("Scanning %s, expecting op, \")\", or \";\"\n",
+        fprintf(msgFile, "Scanning %s, expecting op, \")\", or \";\"\n",
            currentToken -> image);
         abend();
     }
+    return left;
 }
 //-----------------------------------------
-void term(void)
+NODE *term(void)
 {
-    factor();
-    factorList();
+    return factorList(factor());
 }
 //-----------------------------------------
-void termList(void)
+NODE *termList(NODE *left)
 {
     switch(currentToken -> kind)
     {
       case PLUS:
         consume(PLUS);
-        term();
-        emitInstruction1("add");
-        termList();
-        break;
+        return termList(makeNode(PLUS, "+", left, term()));
       case MINUS:
     	  consume(MINUS);
-    	  term();
-    	  emitInstruction1("sub");
-    	  termList();
-    	  break;
+    	  return termList(makeNode(MINUS, "-", left, term()));
       case RIGHTPAREN:
       case SEMICOLON:
         ;
         break;
       default:
         displayErrorLoc();
-        printf(
+        fprintf(msgFile,
            "Scanning %s, expecting \"+\", \")\", or \";\"\n",
            currentToken -> image);
         abend();
     }
+    return left;
 }
 //-----------------------------------------
-void expr(void)
+NODE *expr(void)
 {
-    term();
-    termList();
+    TOKEN *t = currentToken;
+    NODE *p = termList(term());
+
+    p -> start = t;
+    return p;
 }
 //-----------------------------------------
 void assignmentStatement(void)
 {
     TOKEN *t;
+    NODE *p;
+    int i, j, c;
     t = currentToken;
     consume(ID);
-    enter(t -> image);
-    emitInstruction2("pc", t -> image);
+    i = enter(t -> image);
     consume(ASSIGN);
-    assignmentTail();
+    p = assignmentTail();
+    fold(p);
+    if (emitC)
+    {
+       emitCAssign(t -> image, p);
+       setVariable(i, p -> known, p -> value);
+       consume(SEMICOLON);
+       return;
+    }
+    if (extTarget && varPlusConstant(p, &j, &c) && j == i)
+    {
+       emitAddImmediate(t -> image, c);
+       setVariable(i, FALSE, 0);
+       consume(SEMICOLON);
+       return;
+    }
+    emitInstruction2("pc", t -> image);
+    noteInOrder(p);
+    emitExpr(p);
     emitInstruction1("stav");
+    setVariable(i, p -> known, p -> value);
     consume(SEMICOLON);
 }
 //------------------------------------------
-void assignmentTail(void){
+// returns the value being assigned, as an ASSIGN node for each
+// further variable in a chain like a = b = c = expr
+NODE *assignmentTail(void){
 	TOKEN *t;
 	t=getToken(1);
 	TOKEN *t2;
 	t2=getToken(2);
+	NODE *p;
 
 	if(t -> kind == ID && t2 -> kind == ASSIGN){
 		consume(ID);
-		enter(t -> image);
-		emitInstruction2("pc", t -> image);
+		p = makeNode(ASSIGN, t -> image, NULL, NULL);
+		p -> index = enter(t -> image);
+		p -> start = t;
 		consume(ASSIGN);
-		assignmentTail();
-		emitInstruction1("dupe");
-		emitInstruction1("rot");
-		emitInstruction1("stav");
+		p -> right = assignmentTail();
+		return p;
 	}
 	else{
-		expr();
+		return expr();
 	}
 }
 //-----------------------------------------
@@ -658,6 +2156,8 @@ void printlnStatement(void)
     		printArg();
     		break;
     }
+    if (emitC)
+       emitCLine("putchar('\\n');");
     emitInstruction2("pc", "'\\n'");
     emitInstruction1("aout");
     consume(RIGHTPAREN);
@@ -678,6 +2178,7 @@ void printArg(void)
 	switch(currentToken -> kind)
 	{
 	    TOKEN *t;
+	    NODE *p;
 	    char* temp2[100];
 
 	    printf("%s\n",t -> image);
@@ -685,6 +2186,14 @@ void printArg(void)
 		case STRING:
 			t = currentToken;
 			consume(STRING);
+			if (emitC)
+			{
+				emitCIndent();
+				emitCText("fputs(");
+				emitCString(t -> image);
+				emitCText(", stdout);\n");
+				break;
+			}
 			label=getLabel();
 			emitInstruction2("pc",label);
 			emitInstruction1("sout");
@@ -693,7 +2202,17 @@ void printArg(void)
 			emitdw(temp2,t -> image);
 			break;
 		default:
-			expr();
+			if (emitC)
+			{
+				p = expr();
+				fold(p);
+				emitCIndent();
+				emitCText("printf(\"%d\", ");
+				emitCExpr(p);
+				emitCText(");\n");
+				break;
+			}
+			genExpr(expr());
 			emitInstruction1("dout");
 			break;
 	}
@@ -706,9 +2225,10 @@ void nullStatement(void)
 }
 //-----------------------------------------
 void statement(char* exitLabel);
-void statementList(char* exitLabel)
+// TRUE if a token of this kind can start a statement in a list
+int startsStatement(int kind)
 {
-    switch(currentToken -> kind)
+    switch(kind)
     {
       case ID:
       case LEFTBRACKET:
@@ -718,13 +2238,19 @@ void statementList(char* exitLabel)
       case WHILE:
       case SWAP:
       case REPEAT:
-        statement(exitLabel);
-        statementList(exitLabel);
-        break;
       case PRINT:
+        return TRUE;
+      default:
+        return FALSE;
+    }
+}
+//-----------------------------------------
+void statementList(char* exitLabel)
+{
+    while (startsStatement(currentToken -> kind))
         statement(exitLabel);
-        statementList(exitLabel);
-        break;
+    switch(currentToken -> kind)
+    {
       case END:
         ;
         break;
@@ -733,7 +2259,7 @@ void statementList(char* exitLabel)
     	break;
       default:
         displayErrorLoc();
-        printf(
+        fprintf(msgFile,
            "Scanning %s, expecting statement or end of file\n",
            currentToken -> image);
         abend();
@@ -741,20 +2267,120 @@ void statementList(char* exitLabel)
 }
 //-----------------------------------------
 void whileStatement(void){
+	TOKEN *whileToken = currentToken;
+	TOKEN *condToken, *condPrevious;
+	char *entryCounter, *bodyCounter = NULL;
+	int i, unroll = 1;
+	int *killed = NULL, killedx = 0, saveLabelCount, loopTop;
+	NODE *cond;
+
 	consume(WHILE);
+	if (instrument && !dryRun)
+	{
+		if (profx == PROFSIZE)
+		{
+			fprintf(msgFile, "System error: profile table overflow\n");
+			abend();
+		}
+		entryCounter = getLabel();
+		bodyCounter = getLabel();
+		enter(entryCounter);
+		enter(bodyCounter);
+		profLine[profx] = whileToken -> beginLine;
+		profColumn[profx] = whileToken -> beginColumn;
+		profEntryCounter[profx] = entryCounter;
+		profBodyCounter[profx] = bodyCounter;
+		profx++;
+		emitIncrement(entryCounter);
+	}
+	else if (!dryRun && !emitC)
+		unroll = unrollFactor(whileToken -> beginLine,
+		   whileToken -> beginColumn);
+
+	condToken = currentToken;
+	condPrevious = previousToken;
+
+	// Dry run of the condition and body to find the variables the
+	// loop assigns.  They are unknown at the top of the loop, where
+	// the back edge comes in, and so also at the exit.  A loop
+	// inside a dry run needs no dry run of its own.
+	if (!dryRun)
+	{
+		saveLabelCount = labelCount;
+		memset(assigned, FALSE, symbolRoom);
+		dryRun = TRUE;
+		consume(LEFTPAREN);
+		expr();
+		consume(RIGHTPAREN);
+		statement(NULL);
+		dryRun = FALSE;
+		labelCount = saveLabelCount;
+
+		killed = (int *)malloc(symbolx * sizeof(int) + 1);
+		for (i = 0; i < symbolx; i++)
+			if (assigned[i])
+				killed[killedx++] = i;
+		forget(killed, killedx);
+
+		currentToken = condToken;
+		previousToken = condPrevious;
+	}
+
 	char* label1 = getLabel();
 	emitLabel(label1);
+	loopTop = codePosition;
 	consume(LEFTPAREN);
-	expr();
+	cond = expr();
+	fold(cond);
 	consume(RIGHTPAREN);
 	char* label2 =getLabel();
-	emitInstruction2("jz", label2);
+	if (emitC)
+	{
+		emitCIndent();
+		emitCText("while (");
+		emitCExpr(cond);
+		emitCText(")\n");
+		emitCLine("{");
+		cDepth++;
+	}
+	else
+		emitJumpIfZero(cond, label2);
+	if (instrument && !dryRun)
+		emitIncrement(bodyCounter);
+	loopDepth++;
 	statement(label2);
+
+	// Unrolled copies: back up to the condition and parse the
+	// test and body again.  The tokens are still on the token list.
+	for (i = 1; i < unroll; i++)
+	{
+		currentToken = condToken;
+		previousToken = condPrevious;
+		consume(LEFTPAREN);
+		cond = expr();
+		fold(cond);
+		consume(RIGHTPAREN);
+		emitJumpIfZero(cond, label2);
+		statement(label2);
+	}
 	emitInstruction2("ja", label1);
+	loopDepth--;
+	if (!dryRun && !silent && !emitC)
+		noteLoop(loopTop, codePosition);
 	emitLabel(label2);
+	if (emitC)
+	{
+		cDepth--;
+		emitCLine("}");
+	}
+
+	forget(killed, killedx);
+	free(killed);
 }
 //-----------------------------------------
 void breakStatement(char *exitLabel){
+	if (emitC)
+		emitCLine("break;");
 	emitInstruction2("ja", exitLabel);
 	consume(BREAK);
 	consume(SEMICOLON);
@@ -768,19 +2394,49 @@ void compoundStatement(void)
 }
 //-----------------------------------------
 void swapStatement(void){
-	TOKEN *t;
+	TOKEN *t, *t2;
+	int i, j, knownI, valueI;
+	char temp[MAX * 2];
 	consume(SWAP);
 	consume(LEFTPAREN);
 	t = currentToken;
 	consume(ID);
 	consume(COMMA);
-	emitInstruction2("pc", t -> image);
-	emitInstruction2("p", currentToken -> image);
-	emitInstruction2("pc", currentToken -> image);
-	emitInstruction2("p", t -> image);
-	emitInstruction1("stav");
-	emitInstruction1("stav");
+	t2 = currentToken;
 	consume(ID);
+	i = enter(t -> image);
+	j = enter(t2 -> image);
+	if (emitC)
+	{
+		emitCIndent();
+		emitCText("{ int t = ");
+		emitCName(t -> image);
+		emitCText("; ");
+		emitCName(t -> image);
+		emitCText(" = ");
+		emitCName(t2 -> image);
+		emitCText("; ");
+		emitCName(t2 -> image);
+		emitCText(" = t; }\n");
+	}
+	else if (extTarget)
+	{
+		sprintf(temp, "%s,%s", t -> image, t2 -> image);
+		emitInstruction2("swap", temp);
+	}
+	else
+	{
+		emitInstruction2("pc", t -> image);
+		emitVariable(j);
+		emitInstruction2("pc", t2 -> image);
+		emitVariable(i);
+		emitInstruction1("stav");
+		emitInstruction1("stav");
+	}
+	knownI = known[i];
+	valueI = value[i];
+	setVariable(i, known[j], value[j]);
+	setVariable(j, knownI, valueI);
 	consume(RIGHTPAREN);
 	consume(SEMICOLON);
 }
@@ -789,13 +2445,22 @@ void readintStatement(void){
 	consume(READINT);
 	consume(LEFTPAREN);
 	TOKEN *t;
+	int i;
 	switch(currentToken->kind){
 		case ID:
 			t = currentToken;
 			consume(ID);
+			i = enter(t -> image);   // before pc, for trackStorage
+			if (emitC)
+			{
+				emitCIndent();
+				emitCName(t -> image);
+				emitCText(" = dr_readint();\n");
+			}
 			emitInstruction2("pc", t->image);
 			emitInstruction1("din");
 			emitInstruction1("stav");
+			setVariable(i, FALSE, 0);
 		break;
 		default:
 			break;
@@ -836,7 +2501,7 @@ void statement(char *exitLabel)
     	break;
       default:
         displayErrorLoc();
-        printf("Scanning %s, expecting statement\n",
+        fprintf(msgFile, "Scanning %s, expecting statement\n",
            currentToken -> image);
         abend();
     }
@@ -851,7 +2516,7 @@ void repeatStatement(void){
 			label=getLabel();
 			enter(label);
 			emitInstruction2("pc",label);
-			expr();
+			genExpr(expr());
 			emitInstruction1("stav");
 			consume(RIGHTPAREN);
 			switch( currentToken -> kind){
@@ -870,9 +2535,203 @@ void repeatStatement(void){
 	}
 }
 //-----------------------------------------
+// record the start of a new group of top-level statements
+void startGroup(void)
+{
+    GROUP *g;
+
+    if (groupx == groupSize)
+    {
+       groupSize = groupSize ? 2 * groupSize : 64;
+       group = (GROUP *)realloc(group, groupSize * sizeof(GROUP));
+    }
+    g = &group[groupx++];
+    g -> start = currentToken;
+    g -> previous = previousToken;
+    g -> labelCount = labelCount;
+    g -> symbols = symbolx;
+    g -> known = (int *)malloc(symbolx * sizeof(int) + 1);
+    g -> value = (int *)malloc(symbolx * sizeof(int) + 1);
+    memcpy(g -> known, known, symbolx * sizeof(int));
+    memcpy(g -> value, value, symbolx * sizeof(int));
+}
+//-----------------------------------------
+// Codegen thread: generate groups until none are left.  The
+// silent pass already found any syntax errors and entered every
+// symbol, so the symbol table is only read here.  The stack and
+// storage analysis starts afresh for each group and is saved in
+// it for parallelStatementList to join up.
+void *genGroups(void *arg)
+{
+    GROUP *g;
+    int i, n;
+
+    (void)arg;
+    makeSymbolRoom(symbolx);
+    while (TRUE)
+    {
+       pthread_mutex_lock(&groupLock);
+       g = nextGroup < groupx ? &group[nextGroup++] : NULL;
+       pthread_mutex_unlock(&groupLock);
+       if (!g)
+          return NULL;
+
+       outFile = open_memstream(&g -> text, &g -> size);
+       currentToken = g -> start;
+       previousToken = g -> previous;
+       labelCount = g -> labelCount;
+       memcpy(known, g -> known, g -> symbols * sizeof(int));
+       memcpy(value, g -> value, g -> symbols * sizeof(int));
+       for (i = g -> symbols; i < symbolx; i++)
+       {
+          known[i] = TRUE;        // not entered yet, so dw 0
+          value[i] = 0;
+       }
+       commentHead = g -> commentHead;
+       commentTail = g -> commentTail;
+       stackDepth = maxStackDepth = maxInOrderDepth = 0;
+       codePosition = loopx = 0;
+       for (i = 0; i < symbolx; i++)
+       {
+          firstUse[i] = -1;
+          fromStart[i] = stored[i] = FALSE;
+       }
+       g -> tooDeep = NULL;
+       currentGroup = g;
+
+       while (currentToken != g -> end)
+          statement(NULL);
+       fclose(outFile);
+
+       n = symbolx;
+       g -> maxStackDepth = maxStackDepth;
+       g -> maxInOrderDepth = maxInOrderDepth;
+       g -> positions = codePosition;
+       g -> firstUse = (int *)malloc(n * sizeof(int) + 1);
+       g -> lastUse = (int *)malloc(n * sizeof(int) + 1);
+       g -> fromStart = (char *)malloc(n + 1);
+       g -> stored = (char *)malloc(n + 1);
+       memcpy(g -> firstUse, firstUse, n * sizeof(int));
+       memcpy(g -> lastUse, lastUse, n * sizeof(int));
+       memcpy(g -> fromStart, fromStart, n);
+       memcpy(g -> stored, stored, n);
+       g -> loops = loopx;
+       g -> loopStart = (int *)malloc(loopx * sizeof(int) + 1);
+       g -> loopEnd = (int *)malloc(loopx * sizeof(int) + 1);
+       memcpy(g -> loopStart, loopStart, loopx * sizeof(int));
+       memcpy(g -> loopEnd, loopEnd, loopx * sizeof(int));
+    }
+}
+//-----------------------------------------
+// Generate the top-level statements on jobs threads.  The output
+// is the same as statementList(NULL) would give.
+void parallelStatementList(void)
+{
+    pthread_t thread[MAXJOBS];
+    COMMENT *c;
+    GROUP *g;
+    int i, j, n = 0;
+
+    // silent pass: parse everything and record the groups
+    silent = TRUE;
+    while (startsStatement(currentToken -> kind))
+    {
+       // A group's state holds an entry per symbol, so a program
+       // with many symbols is split into fewer, bigger groups.
+       if (n == 0 || (n >= CODEGENGROUP && n >= symbolx / 8))
+       {
+          startGroup();
+          n = 0;
+       }
+       n++;
+       statement(NULL);
+    }
+    silent = FALSE;
+    statementList(NULL);      // check for a proper end
+
+    // Each group outputs the comments up to the line of the token
+    // that follows it, as advance would have during the group.
+    for (i = 0; i < groupx; i++)
+    {
+       group[i].end = (i + 1 < groupx) ? group[i + 1].start
+          : currentToken;
+       group[i].commentHead = group[i].commentTail = NULL;
+       while (commentHead &&
+          commentHead -> line <= group[i].end -> beginLine)
+       {
+          c = commentHead;
+          commentHead = c -> next;
+          c -> next = NULL;
+          if (group[i].commentTail)
+             group[i].commentTail -> next = c;
+          else
+             group[i].commentHead = c;
+          group[i].commentTail = c;
+       }
+    }
+    if (!commentHead)
+       commentTail = NULL;
+
+    for (i = 0; i < jobs; i++)
+       if (pthread_create(&thread[i], NULL, genGroups, NULL))
+       {
+          fprintf(msgFile, "System error: cannot create thread\n");
+          abend();
+       }
+    for (i = 0; i < jobs; i++)
+       pthread_join(thread[i], NULL);
+
+    for (i = 0; i < groupx; i++)
+       if (group[i].tooDeep)
+          stackTooDeep(group[i].tooDeep);
+
+    // Join up the groups' analysis as if the code were one stream.
+    // A symbol may still hold its dw 0 when a group reads it only
+    // if no group before stored into it.
+    for (i = 0; i < groupx; i++)
+    {
+       g = &group[i];
+       fwrite(g -> text, 1, g -> size, outFile);
+       if (g -> maxStackDepth > maxStackDepth)
+          maxStackDepth = g -> maxStackDepth;
+       if (g -> maxInOrderDepth > maxInOrderDepth)
+          maxInOrderDepth = g -> maxInOrderDepth;
+       for (j = 0; j < symbolx; j++)
+          if (g -> firstUse[j] >= 0)
+          {
+             if (firstUse[j] < 0)
+                firstUse[j] = codePosition + g -> firstUse[j];
+             lastUse[j] = codePosition + g -> lastUse[j];
+             if (g -> fromStart[j] && !stored[j])
+                fromStart[j] = TRUE;
+             if (g -> stored[j])
+                stored[j] = TRUE;
+          }
+       for (j = 0; j < g -> loops; j++)
+          noteLoop(codePosition + g -> loopStart[j],
+             codePosition + g -> loopEnd[j]);
+       codePosition += g -> positions;
+       free(g -> text);
+       free(g -> known);
+       free(g -> value);
+       free(g -> firstUse);
+       free(g -> lastUse);
+       free(g -> fromStart);
+       free(g -> stored);
+       free(g -> loopStart);
+       free(g -> loopEnd);
+    }
+}
+//-----------------------------------------
 void program(void)
 {
-    statementList(NULL);
+    // Statements are generated in parallel only for a file big
+    // enough to have been lexed in parallel.  The profile counters
+    // of --instrument are kept serially.
+    if (chunkCount > 1 && !instrument)
+       parallelStatementList();
+    else
+       statementList(NULL);
     endCode();
 }
 //-----------------------------------------
@@ -882,56 +2741,298 @@ void parse(void)
     program();   // program is start symbol for grammar
 }
 //-----------------------------------------
-int main(int argc, char *argv[])
+// Set one option (see main).  Returns FALSE, with a message, if
+// arg is not a valid option.
+int setOption(char *arg)
 {
-   printf("DRCompiler compiler written by Arturo Rodriguez-Veve\n");
-   if (!(argc == 2 || argc == 3))
+   if (!strcmp(arg, "debug_token_manager"))
+      debug = TRUE;
+   else if (!strcmp(arg, "--instrument"))
+      instrument = TRUE;
+   else if (!strncmp(arg, "--profile=", 10))
+      profileName = arg + 10;
+   else if (!strcmp(arg, "--target=ext"))
+      extTarget = TRUE;
+   else if (!strcmp(arg, "--target=base"))
+      extTarget = FALSE;
+   else if (!strcmp(arg, "--emit=c"))
+      emitC = TRUE;
+   else if (!strcmp(arg, "--emit=asm"))
+      emitC = FALSE;
+   else if (!strncmp(arg, "--stack-limit=", 14))
    {
-      printf("Incorrect number of command line args\n");
-      exit(1);
+      stackLimit = atoi(arg + 14);
+      if (stackLimit < 1)
+      {
+         fprintf(msgFile, "--stack-limit must be at least 1\n");
+         return FALSE;
+      }
    }
-   int loc=2;
-   if(argc==2){
-	   loc=1;
+   else if (!strncmp(arg, "--jobs=", 7))
+   {
+      jobs = atoi(arg + 7);
+      if (jobs < 1 || jobs > MAXJOBS)
+      {
+         fprintf(msgFile, "--jobs must be from 1 to %d\n", MAXJOBS);
+         return FALSE;
+      }
    }
-   else{
-	   char *arg1=argv[1];
-	   loc =2;
-	   if(strcmp(arg1, "debug_token_manager")){
-		   debug=TRUE;
-	   }
-	   else{
-		   printf("%s is not a valid argument",arg1);
-	   }
-
+   else
+   {
+      fprintf(msgFile, "%s is not a valid argument\n", arg);
+      return FALSE;
    }
-    // build the input and output file names
-    strcpy(inFileName, argv[loc]);
-    strcat(inFileName, ".s");       // append extension
+   return TRUE;
+}
+//-----------------------------------------
+// check that the options set go together
+int checkOptions(void)
+{
+   if (instrument && profileName)
+   {
+      fprintf(msgFile, "--instrument and --profile cannot be combined\n");
+      return FALSE;
+   }
+   if (emitC && (instrument || profileName || extTarget))
+   {
+      fprintf(msgFile, "--emit=c cannot be combined with --instrument, "
+         "--profile or --target=ext\n");
+      return FALSE;
+   }
+   return TRUE;
+}
+//-----------------------------------------
+// compile inFile into outFile
+void compile(void)
+{
+    char temp[MAX], line[MAX + 8];
+    long cpus;
 
-    strcpy(outFileName, argv[loc]);
-    strcat(outFileName, ".a");      // append extension
+    if (!symbolSize)
+       growSymbols();
+    makeSymbolRoom(SYMTABSIZE);
+    time(&timer);     // get time
+    sprintf(temp, "Arturo Rodriguez-Veve    %s",
+       asctime(localtime(&timer)));
+    makeComment(line, temp);
+    fputs(line, outFile);
+    makeComment(line, "Output from DRCompiler compiler\n");
+    fputs(line, outFile);
 
-    inFile = fopen(inFileName, "r");
-    if (!inFile)
+    // Room for the ;#stack directive, filled in by endCode.  Not
+    // for a compile server reply, as rewinding a memory stream
+    // would cut it short there.
+    if (!emitC)
     {
-       printf("Error: Cannot open %s\n", inFileName);
-       exit(1);
+       stackDirective = serving ? -1 : ftell(outFile);
+       if (stackDirective >= 0)
+          fprintf(outFile, ";#stack %-10s\n", "");
     }
-    outFile = fopen(outFileName, "w");
-    if (!outFile)
+
+    // C output: main's body is generated into memory (see cFile)
+    else
     {
-       printf("Error: Cannot open %s\n", outFileName);
-       exit(1);
+       fputs(cPrelude, outFile);
+       cFile = outFile;
+       outFile = open_memstream(&cBody, &cBodySize);
     }
 
-    time(&timer);     // get time
-    fprintf(outFile, "; Arturo Rodriguez-Veve    %s",
-       asctime(localtime(&timer)));
-    fprintf(outFile,
-       "; Output from DRCompiler compiler\n");
+    // A pipe is read as it comes, so only a file is lexed in
+    // parallel.  More threads than CPUs would only take turns.
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus > 0 && jobs > cpus)
+       jobs = cpus;
+    if (jobs > 1 && !streaming)
+       lexParallel();
 
     parse();
+}
+//-----------------------------------------
+// TRUE if a request may set option arg.  Only the options that
+// shape the code are allowed; the rest, such as --profile, which
+// would open a file of the client's choosing, and --jobs, are for
+// the server's command line.
+int requestOption(char *arg)
+{
+   return !strcmp(arg, "debug_token_manager") ||
+      !strncmp(arg, "--target=", 9) || !strncmp(arg, "--emit=", 7) ||
+      !strncmp(arg, "--stack-limit=", 14);
+}
+//-----------------------------------------
+// Compile server child: handle the request on socket fd.  The
+// request is one line of options, which add to the server's own,
+// followed by the source up to end of file.
+void serveRequest(int fd)
+{
+   char line[MAX], *arg;
+
+   serving = TRUE;
+   replyFd = fd;
+   outFile = open_memstream(&codeText, &codeSize);
+   msgFile = open_memstream(&msgText, &msgSize);
+   strcpy(inFileName, "<socket>");
+   inFile = fdopen(dup(fd), "r");
+   if (!inFile || !fgets(line, sizeof(line), inFile))
+   {
+      fprintf(msgFile, "Error: Cannot read request\n");
+      quit();
+   }
+
+   for (arg = strtok(line, " \t\r\n"); arg; arg = strtok(NULL, " \t\r\n"))
+   {
+      if (!requestOption(arg))
+      {
+         fprintf(msgFile, "%s is not allowed in a request\n", arg);
+         quit();
+      }
+      if (!setOption(arg))
+         quit();
+   }
+   if (!checkOptions())
+      quit();
+
+   compile();
+   fclose(inFile);
+   finishRequest(0);
+}
+//-----------------------------------------
+// Compile server: listen on the Unix domain socket at path and
+// compile each request in a child process, so requests run
+// concurrently and an error ends only its own child.  Children
+// start from the server's state: its options and loaded profile
+// are already set up, and the program is already loaded and
+// linked.
+void serve(char *path)
+{
+   int listener, fd;
+   struct sockaddr_un addr;
+
+   if (strlen(path) >= sizeof(addr.sun_path))
+   {
+      fprintf(msgFile, "Error: Socket name %s too long\n", path);
+      exit(1);
+   }
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   strcpy(addr.sun_path, path);
+   unlink(path);
+
+   listener = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (listener < 0 ||
+      bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(listener, SOMAXCONN) < 0)
+   {
+      fprintf(msgFile, "Error: Cannot listen on %s\n", path);
+      exit(1);
+   }
+   signal(SIGCHLD, SIG_IGN);     // children are not waited for
+   fprintf(msgFile, "Listening on %s\n", path);
+   fflush(msgFile);
+
+   while (TRUE)
+   {
+      fd = accept(listener, NULL, NULL);
+      if (fd < 0)
+         continue;
+      if (fork() == 0)
+      {
+         close(listener);
+         serveRequest(fd);
+      }
+      close(fd);
+   }
+}
+//-----------------------------------------
+// Usage: DRCompiler [options] <name>
+// Compiles <name>.s into <name>.a.  If <name> is "-", source is
+// read from stdin and code is written to stdout, so the compiler
+// can sit in a pipeline.  Messages then go to stderr.
+// Options:
+//   debug_token_manager  trace tokens into the output
+//   --instrument         count loop trips, print profile at halt
+//   --profile=<file>     unroll loops the profile shows are hot
+//   --target=ext         use the fused instructions of the
+//                        extended ISA (see DRInterp.c)
+//   --emit=c             write C source to <name>.c instead of
+//                        stack machine code
+//   --stack-limit=<n>    reject programs whose operand stack
+//                        would hold more than n entries
+//   --jobs=<n>           lex the source file and generate code
+//                        on n threads
+//   --serve              run as a compile server on the Unix
+//                        domain socket <name> (see serveRequest)
+int main(int argc, char *argv[])
+{
+   int i, loc, server = FALSE;
+
+   msgFile = stdout;
+   loc = argc - 1;     // file name is always the last arg
+   if (loc >= 1 && !strcmp(argv[loc], "-"))
+   {
+      streaming = TRUE;
+      msgFile = stderr;
+   }
+
+   fprintf(msgFile, "DRCompiler compiler written by Arturo Rodriguez-Veve\n");
+   if (argc < 2)
+   {
+      fprintf(msgFile, "Incorrect number of command line args\n");
+      exit(1);
+   }
+   for (i = 1; i < loc; i++)
+   {
+      if (!strcmp(argv[i], "--serve"))
+         server = TRUE;
+      else if (!setOption(argv[i]))
+         exit(1);
+   }
+   if (!checkOptions())
+      exit(1);
+   if (profileName)
+      readProfile(profileName);
+
+   if (server)
+   {
+      streaming = FALSE;
+      serve(argv[loc]);
+   }
+
+   if (streaming)
+   {
+      strcpy(inFileName, "<stdin>");
+      strcpy(outFileName, "<stdout>");
+      inFile = stdin;
+      outFile = stdout;
+   }
+   else
+   {
+      // build the input and output file names
+      if (strlen(argv[loc]) + 3 > MAX)
+      {
+         fprintf(msgFile, "Error: File name %s too long\n", argv[loc]);
+         exit(1);
+      }
+      strcpy(inFileName, argv[loc]);
+      strcat(inFileName, ".s");       // append extension
+
+      strcpy(outFileName, argv[loc]);
+      strcat(outFileName, emitC ? ".c" : ".a");   // append extension
+
+      inFile = fopen(inFileName, "r");
+      if (!inFile)
+      {
+         fprintf(msgFile, "Error: Cannot open %s\n", inFileName);
+         exit(1);
+      }
+      outFile = fopen(outFileName, "w");
+      if (!outFile)
+      {
+         fprintf(msgFile, "Error: Cannot open %s\n", outFileName);
+         exit(1);
+      }
+   }
+
+    compile();
 
     fclose(inFile);
 
@@ -941,4 +3042,3 @@ int main(int argc, char *argv[])
     // 0 return code means compile ended without error
     return 0;
 }
-
@@ -0,0 +1,616 @@
+// Differential tester for DRCompiler and DRInterp
+//
+// Generates random programs and works out what each should print
+// with a reference evaluator.  Then it compiles and runs each
+// program every way the tools allow and checks that every run
+// prints the same and stops the same way:
+//
+//   DRCompiler name, run by DRInterp with and without --interp
+//   DRCompiler --target=ext name, run the same two ways
+//   DRCompiler --emit=c name, built with the C compiler
+//
+// It also checks that --stack-limit accepts the code at the depth
+// its ;#stack directive gives and rejects it one below.  A program
+// that fails is kept as failN.s, with its input in failN.in.  The
+// seed is printed first, so a run can be repeated with --seed.
+//
+// Usage: DRFuzz [--count=n] [--seed=n] [--compiler=path]
+//               [--interp=path] [--cc=command]
+
+#include <stdio.h>     // needed by I/O functions
+#include <stdlib.h>    // needed by malloc, rand and system
+#include <string.h>    // needed by str functions
+#include <time.h>      // needed by time
+#include <sys/wait.h>  // needed by WEXITSTATUS
+
+#define FALSE 0
+#define TRUE 1
+#define MAX 1024             // max command length
+#define VARS 14              // variables the programs use
+#define MAXDEPTH 2           // max nesting of while loops
+#define INPUTS 200           // integers in each program's input
+#define MAXOUTPUT (1 << 20)  // longest output checked
+
+// expression kinds, besides the operators '+', '-', '*' and '/'
+#define NUM 1
+#define VAR 2
+#define NEG 3
+
+// statement kinds
+#define ASSIGN 1     // a = b = expr;
+#define PRINT 2      // print(expr);
+#define PRINTLN 3    // println(expr);
+#define STRING 4     // print("...") or println("...")
+#define SWAP 5       // swap(a, b);
+#define READINT 6    // readint(a);
+#define ADD 7        // a = a + n;
+#define LOOP 8       // i = n; while (i) { ... i = i - 1; }
+
+// The variables, then a loop counter for each nesting depth,
+// which only its loop assigns.
+char *varName = "abcdefghlmnopq";
+char *counterName = "ijk";
+
+// Strings and trailing comments with the characters that need
+// care in the code and C the compiler writes.
+char *strings[] = {"s0", "hello world", "a\\b", "what?\?=", "50%"};
+char *comments[] = {"", " // plain", " // ends in \\", " // really?\?/",
+   " // x\\ ", " // crlf\r", " // crlf\\\r"};
+#define STRINGS 5
+#define COMMENTS 7
+
+//create new type named EXPR for a generated expression tree
+typedef struct exprtype
+{
+   int kind;                 // NUM, VAR, NEG, or an operator
+   int value;                // number, or variable index
+   int parens;               // TRUE to print in parentheses
+   struct exprtype *left, *right;
+} EXPR;
+
+//create new type named STMT for a generated statement
+typedef struct stmttype
+{
+   int kind;
+   int var[3], vars;         // variables it names
+   int value;                // constant, string, or loop trips
+   int newline;              // STRING: println rather than print
+   int comment;              // index into comments
+   EXPR *expr;
+   struct stmttype *body;    // LOOP: the statements in the loop
+   struct stmttype *next;
+} STMT;
+
+char *compiler = "./DRCompiler";
+char *interp = "./DRInterp";
+char *cc = "cc";
+
+// Reference evaluator state.  The output stops at a division by
+// zero, which is also how the compiled program has to stop.
+int variable[VARS + MAXDEPTH + 1];
+int input[INPUTS], inputx;
+char *output, *runOutput;
+int outputx, divZero, tooLong;
+
+//-----------------------------------------
+int rnd(int n)
+{
+   return rand() % n;
+}
+//-----------------------------------------
+int name(int i)
+{
+   return i < VARS ? varName[i] : counterName[i - VARS];
+}
+//-----------------------------------------
+// make a random expression, nested up to 4 deep
+EXPR *genExpr(int depth)
+{
+   EXPR *p = (EXPR *)calloc(1, sizeof(EXPR));
+   int r = rnd(10);
+
+   if (depth > 3 || r < 3)
+   {
+      p -> kind = rnd(2) ? NUM : VAR;
+      p -> value = p -> kind == NUM ? rnd(21) : rnd(VARS);
+   }
+   else if (r < 4)
+   {
+      p -> kind = NEG;
+      p -> left = genExpr(depth + 1);
+   }
+   else
+   {
+      p -> kind = "+-*/"[rnd(4)];
+      p -> left = genExpr(depth + 1);
+      p -> right = genExpr(depth + 1);
+   }
+   p -> parens = rnd(10) == 0;
+   return p;
+}
+//-----------------------------------------
+// Pick n variables for statement s.  One in four repeats the one
+// before, for chains like a = a = 5 and swap(a, a).
+void pickVars(STMT *s, int n)
+{
+   for (s -> vars = 0; s -> vars < n; s -> vars++)
+      s -> var[s -> vars] = s -> vars > 0 && rnd(4) == 0 ?
+         s -> var[s -> vars - 1] : rnd(VARS);
+}
+//-----------------------------------------
+STMT *genStatements(int depth, int n);
+
+// make a random statement inside depth loops
+STMT *genStatement(int depth)
+{
+   STMT *s = (STMT *)calloc(1, sizeof(STMT));
+   int r = rnd(40);
+
+   if (r < 14)
+   {
+      s -> kind = ASSIGN;
+      pickVars(s, 1 + rnd(3));
+      s -> expr = genExpr(0);
+   }
+   else if (r < 24)
+   {
+      s -> kind = r < 20 ? PRINT : PRINTLN;
+      s -> expr = genExpr(0);
+   }
+   else if (r < 28)
+   {
+      s -> kind = SWAP;
+      pickVars(s, 2);
+   }
+   else if (r < 30)
+   {
+      s -> kind = STRING;
+      s -> value = rnd(STRINGS);
+      s -> newline = rnd(2);
+   }
+   else if (r < 34 && depth < MAXDEPTH)
+   {
+      s -> kind = LOOP;
+      s -> var[0] = VARS + depth;
+      s -> value = rnd(6);
+      s -> body = genStatements(depth + 1, 1 + rnd(4));
+   }
+   else if (r < 37)
+   {
+      s -> kind = ADD;
+      pickVars(s, 1);
+      s -> value = 1 + rnd(3);
+   }
+   else
+   {
+      s -> kind = READINT;
+      pickVars(s, 1);
+   }
+   s -> comment = rnd(4) ? 0 : rnd(COMMENTS);
+   return s;
+}
+//-----------------------------------------
+STMT *genStatements(int depth, int n)
+{
+   STMT *first = NULL, **last = &first;
+
+   while (n-- > 0)
+   {
+      *last = genStatement(depth);
+      last = &(*last) -> next;
+   }
+   return first;
+}
+//-----------------------------------------
+int precedence(EXPR *p)
+{
+   switch (p -> kind)
+   {
+      case '+':
+      case '-':
+         return 1;
+      case '*':
+      case '/':
+         return 2;
+      default:
+         return 3;
+   }
+}
+//-----------------------------------------
+void printExpr(FILE *f, EXPR *p);
+
+void printOperand(FILE *f, EXPR *p, int parens)
+{
+   if (parens)
+      fputc('(', f);
+   printExpr(f, p);
+   if (parens)
+      fputc(')', f);
+}
+//-----------------------------------------
+// Print p with only the parentheses it needs, and those it was
+// given.  Operators are left associative.
+void printExpr(FILE *f, EXPR *p)
+{
+   if (p -> parens)
+      fputc('(', f);
+   switch (p -> kind)
+   {
+      case NUM:
+         fprintf(f, "%d", p -> value);
+         break;
+      case VAR:
+         fputc(name(p -> value), f);
+         break;
+      case NEG:
+         fputc('-', f);
+         printOperand(f, p -> left,
+            p -> left -> kind != NUM && p -> left -> kind != VAR);
+         break;
+      default:
+         printOperand(f, p -> left, precedence(p -> left) < precedence(p));
+         fprintf(f, " %c ", p -> kind);
+         printOperand(f, p -> right,
+            precedence(p -> right) <= precedence(p));
+   }
+   if (p -> parens)
+      fputc(')', f);
+}
+//-----------------------------------------
+void indent(FILE *f, int depth)
+{
+   fprintf(f, "%*s", 3 * depth, "");
+}
+//-----------------------------------------
+void printStatements(FILE *f, STMT *s, int depth)
+{
+   int i, c;
+
+   for (; s; s = s -> next)
+   {
+      indent(f, depth);
+      c = name(s -> var[0]);
+      switch (s -> kind)
+      {
+         case ASSIGN:
+            for (i = 0; i < s -> vars; i++)
+               fprintf(f, "%c = ", name(s -> var[i]));
+            printExpr(f, s -> expr);
+            fputc(';', f);
+            break;
+         case PRINT:
+         case PRINTLN:
+            fputs(s -> kind == PRINT ? "print(" : "println(", f);
+            printExpr(f, s -> expr);
+            fputs(");", f);
+            break;
+         case STRING:
+            fprintf(f, "%s(\"%s\");", s -> newline ? "println" : "print",
+               strings[s -> value]);
+            break;
+         case SWAP:
+            fprintf(f, "swap(%c, %c);", c, name(s -> var[1]));
+            break;
+         case READINT:
+            fprintf(f, "readint(%c);", c);
+            break;
+         case ADD:
+            fprintf(f, "%c = %c + %d;", c, c, s -> value);
+            break;
+         case LOOP:
+            fprintf(f, "%c = %d;\n", c, s -> value);
+            indent(f, depth);
+            fprintf(f, "while (%c)\n", c);
+            indent(f, depth);
+            fputs("{\n", f);
+            printStatements(f, s -> body, depth + 1);
+            indent(f, depth + 1);
+            fprintf(f, "%c = %c - 1;\n", c, c);
+            indent(f, depth);
+            fputc('}', f);
+            break;
+      }
+      fprintf(f, "%s\n", comments[s -> comment]);
+   }
+}
+//-----------------------------------------
+// write the program to name.s and its input to name.in
+void writeProgram(char *name, STMT *program)
+{
+   char fileName[MAX];
+   FILE *f;
+   int i;
+
+   sprintf(fileName, "%s.s", name);
+   f = fopen(fileName, "w");
+   printStatements(f, program, 0);
+   fclose(f);
+   sprintf(fileName, "%s.in", name);
+   f = fopen(fileName, "w");
+   for (i = 0; i < INPUTS; i++)
+      fprintf(f, "%d\n", input[i]);
+   fclose(f);
+}
+//-----------------------------------------
+// add text to the reference output
+void emit(char *text)
+{
+   int n = strlen(text);
+
+   if (outputx + n > MAXOUTPUT)
+   {
+      tooLong = TRUE;
+      return;
+   }
+   memcpy(output + outputx, text, n);
+   outputx += n;
+}
+//-----------------------------------------
+// Evaluate p as the stack machine would: arithmetic wraps, and
+// dividing by -1 negates.  Sets divZero on a division by zero.
+int eval(EXPR *p)
+{
+   int left, right;
+
+   switch (p -> kind)
+   {
+      case NUM:
+         return p -> value;
+      case VAR:
+         return variable[p -> value];
+      case NEG:
+         return (int)(0u - (unsigned)eval(p -> left));
+   }
+   left = eval(p -> left);
+   right = eval(p -> right);
+   switch (p -> kind)
+   {
+      case '+':
+         return (int)((unsigned)left + (unsigned)right);
+      case '-':
+         return (int)((unsigned)left - (unsigned)right);
+      case '*':
+         return (int)((unsigned)left * (unsigned)right);
+   }
+   if (right == 0)
+   {
+      divZero = TRUE;
+      return 0;
+   }
+   return right == -1 ? (int)(0u - (unsigned)left) : left / right;
+}
+//-----------------------------------------
+// run statements s on the reference evaluator
+void run(STMT *s)
+{
+   char temp[16];
+   int i, v, c;
+
+   for (; s && !divZero && !tooLong; s = s -> next)
+   {
+      c = s -> var[0];
+      switch (s -> kind)
+      {
+         case ASSIGN:
+            v = eval(s -> expr);
+            for (i = 0; i < s -> vars && !divZero; i++)
+               variable[s -> var[i]] = v;
+            break;
+         case PRINT:
+         case PRINTLN:
+            v = eval(s -> expr);
+            if (divZero)
+               break;
+            sprintf(temp, "%d", v);
+            emit(temp);
+            if (s -> kind == PRINTLN)
+               emit("\n");
+            break;
+         case STRING:
+            emit(strings[s -> value]);
+            if (s -> newline)
+               emit("\n");
+            break;
+         case SWAP:
+            v = variable[c];
+            variable[c] = variable[s -> var[1]];
+            variable[s -> var[1]] = v;
+            break;
+         case READINT:
+            variable[c] = inputx < INPUTS ? input[inputx++] : 0;
+            break;
+         case ADD:
+            variable[c] = (int)((unsigned)variable[c] + s -> value);
+            break;
+         case LOOP:
+            variable[c] = s -> value;
+            while (variable[c] && !divZero && !tooLong)
+            {
+               run(s -> body);
+               variable[c]--;
+            }
+            break;
+      }
+   }
+}
+//-----------------------------------------
+// TRUE if command ran and exited with status 0
+int succeeds(char *command)
+{
+   int status = system(command);
+
+   return status != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+//-----------------------------------------
+// Run command, which writes the program's output to drfuzz.out,
+// and check it against the reference run.  Reports what differs
+// under the name what.
+int check(char *what, char *command)
+{
+   FILE *f;
+   int ok = succeeds(command), n = 0;
+
+   f = fopen("drfuzz.out", "r");
+   if (f)
+   {
+      n = fread(runOutput, 1, MAXOUTPUT + 1, f);
+      fclose(f);
+   }
+   if (ok == divZero)
+   {
+      printf("%s: %s\n", what, divZero ? "ran on after division by zero"
+         : "failed");
+      return FALSE;
+   }
+   if (n != outputx || memcmp(runOutput, output, n))
+   {
+      printf("%s: output differs\n", what);
+      return FALSE;
+   }
+   return TRUE;
+}
+//-----------------------------------------
+// compile drfuzz.s with opts and run it both ways DRInterp can
+int checkInterp(char *opts)
+{
+   char command[MAX], what[MAX];
+   int ok;
+
+   sprintf(command, "%s %s drfuzz > /dev/null 2>&1", compiler, opts);
+   if (!succeeds(command))
+   {
+      printf("DRCompiler %s: compile failed\n", opts);
+      return FALSE;
+   }
+   sprintf(what, "DRCompiler %s, DRInterp", opts);
+   sprintf(command, "%s drfuzz.a < drfuzz.in > drfuzz.out 2> /dev/null",
+      interp);
+   ok = check(what, command);
+   sprintf(what, "DRCompiler %s, DRInterp --interp", opts);
+   sprintf(command,
+      "%s --interp drfuzz.a < drfuzz.in > drfuzz.out 2> /dev/null", interp);
+   return check(what, command) && ok;
+}
+//-----------------------------------------
+// compile drfuzz.s to C and run that
+int checkC(void)
+{
+   char command[MAX];
+
+   sprintf(command, "%s --emit=c drfuzz > /dev/null 2>&1", compiler);
+   if (!succeeds(command))
+   {
+      printf("DRCompiler --emit=c: compile failed\n");
+      return FALSE;
+   }
+   sprintf(command, "%s -std=c99 -O2 -Wall -Werror -o drfuzz.exe drfuzz.c"
+      " > /dev/null 2>&1", cc);
+   if (!succeeds(command))
+   {
+      printf("%s: cannot build the C\n", cc);
+      return FALSE;
+   }
+   return check("DRCompiler --emit=c",
+      "./drfuzz.exe < drfuzz.in > drfuzz.out 2> /dev/null");
+}
+//-----------------------------------------
+// Check --stack-limit against the ;#stack directive of the code
+// last compiled without --target=ext.
+int checkStackLimit(void)
+{
+   char command[MAX], line[MAX];
+   FILE *f;
+   int n = -1, ok = TRUE;
+
+   sprintf(command, "%s drfuzz > /dev/null 2>&1", compiler);
+   succeeds(command);
+   f = fopen("drfuzz.a", "r");
+   while (f && fgets(line, sizeof(line), f))
+      if (sscanf(line, ";#stack %d", &n) == 1)
+         break;
+   if (f)
+      fclose(f);
+   if (n < 0)
+   {
+      printf("DRCompiler: no ;#stack directive\n");
+      return FALSE;
+   }
+   sprintf(command, "%s --stack-limit=%d drfuzz > /dev/null 2>&1",
+      compiler, n);
+   if (n > 0 && !succeeds(command))
+   {
+      printf("DRCompiler --stack-limit=%d: rejected code of depth %d\n",
+         n, n);
+      ok = FALSE;
+   }
+   sprintf(command, "%s --stack-limit=%d drfuzz > /dev/null 2>&1",
+      compiler, n - 1);
+   if (n > 1 && succeeds(command))
+   {
+      printf("DRCompiler --stack-limit=%d: accepted code of depth %d\n",
+         n - 1, n);
+      ok = FALSE;
+   }
+   return ok;
+}
+//-----------------------------------------
+int main(int argc, char *argv[])
+{
+   STMT *program;
+   char temp[MAX];
+   unsigned seed = time(NULL);
+   int count = 100, failures = 0, skipped = 0, i, n, ok;
+
+   for (i = 1; i < argc; i++)
+   {
+      if (!strncmp(argv[i], "--count=", 8))
+         count = atoi(argv[i] + 8);
+      else if (!strncmp(argv[i], "--seed=", 7))
+         seed = strtoul(argv[i] + 7, NULL, 10);
+      else if (!strncmp(argv[i], "--compiler=", 11))
+         compiler = argv[i] + 11;
+      else if (!strncmp(argv[i], "--interp=", 9))
+         interp = argv[i] + 9;
+      else if (!strncmp(argv[i], "--cc=", 5))
+         cc = argv[i] + 5;
+      else
+      {
+         fprintf(stderr, "Usage: DRFuzz [--count=n] [--seed=n] "
+            "[--compiler=path] [--interp=path] [--cc=command]\n");
+         exit(1);
+      }
+   }
+   printf("seed %u\n", seed);
+   srand(seed);
+   output = (char *)malloc(MAXOUTPUT);
+   runOutput = (char *)malloc(MAXOUTPUT + 1);
+
+   for (n = 0; n < count; n++)
+   {
+      program = genStatements(0, 5 + rnd(21));
+      for (i = 0; i < INPUTS; i++)
+         input[i] = rnd(11) - 5;
+      memset(variable, 0, sizeof(variable));
+      inputx = outputx = divZero = tooLong = 0;
+      run(program);
+      if (tooLong)
+      {
+         skipped++;
+         continue;
+      }
+      writeProgram("drfuzz", program);
+
+      ok = checkInterp("");
+      ok = checkInterp("--target=ext") && ok;
+      ok = checkC() && ok;
+      ok = checkStackLimit() && ok;
+      if (!ok)
+      {
+         sprintf(temp, "fail%d", ++failures);
+         writeProgram(temp, program);
+         printf("program %d kept as %s.s\n", n + 1, temp);
+      }
+   }
+   printf("%d programs, %d failed, %d skipped\n", count, failures, skipped);
+   return failures ? 1 : 0;
+}
@@ -0,0 +1,1000 @@
+// Interpreter for the stack machine code DRCompiler emits
+// Arturo Rodrigeuz-Veve
+//
+// Runs a .a file produced by DRCompiler, for either target:
+//
+// Base ISA
+//   pwc n      push the constant n
+//   p x        push the value of x
+//   pc x       push the address of x (or a char constant like '\n')
+//   stav       pop value, pop address, store value at address
+//   add sub mult div
+//              pop right, pop left, push left op right
+//   neg        negate the top of stack
+//   dupe       push a copy of the top of stack
+//   rot        move the top of stack below the next two
+//   jz L       pop, jump to L if zero
+//   ja L       jump to L
+//   din        read an integer and push it
+//   dout       pop and print as a decimal
+//   aout       pop and print as a char
+//   sout       pop an address and print the string there
+//   halt       stop
+//
+// Extended ISA (DRCompiler --target=ext)
+//   inc x      x = x + 1
+//   dec x      x = x - 1
+//   addi x,n   x = x + n
+//   stk x      store top of stack into x, keep it on the stack
+//   jeq x,n,L  jump to L if x == n
+//   swap x,y   exchange x and y
+//
+// On x86-64 the program is translated to native code by a JIT
+// (see jitCompile) unless --interp is given.
+//
+// A label on a line of its own labels the next instruction or
+// dw, so several labels can name one word of data.
+//
+// The ";#stack n" directive DRCompiler writes gives the most
+// entries the operand stack holds.  The stack is allocated at
+// that size once verifyStack has checked the code against it.
+#include <stdio.h>  // needed by I/O functions
+#include <stdlib.h> // needed by malloc and exit
+#include <string.h> // needed by str functions
+#include <ctype.h>  // needed by isspace, etc.
+#include <stdarg.h> // needed by jitBytes
+#include <sys/mman.h>  // needed by mmap for the JIT
+
+#define TRUE 1
+#define FALSE 0
+
+#define MAX 400            // size of line buffer
+#define STACKSIZE 10000    // operand stack size if not verified
+#define HASHSIZE 4096      // label hash table size
+
+// Opcodes
+#define PWC 0
+#define P 1
+#define PC 2
+#define STAV 3
+#define ADD 4
+#define SUB 5
+#define MULT 6
+#define DIV 7
+#define NEG 8
+#define DUPE 9
+#define ROT 10
+#define JZ 11
+#define JA 12
+#define DIN 13
+#define DOUT 14
+#define AOUT 15
+#define SOUT 16
+#define HALT 17
+#define INC 18
+#define DEC 19
+#define ADDI 20
+#define STK 21
+#define JEQ 22
+#define SWAP 23
+#define NUMOPS 24
+
+char *opName[NUMOPS] =
+{
+  "pwc", "p", "pc", "stav", "add", "sub", "mult", "div", "neg",
+  "dupe", "rot", "jz", "ja", "din", "dout", "aout", "sout", "halt",
+  "inc", "dec", "addi", "stk", "jeq", "swap"
+};
+
+// Stack effect of each opcode: the entries it takes off the
+// operand stack, and the entries it puts back.
+int stackIn[NUMOPS] =
+  {0, 0, 0, 2, 2, 2, 2, 2, 1, 1, 3, 1, 0, 0, 1, 1, 1, 0, 0, 0, 0, 1, 0, 0};
+int stackOut[NUMOPS] =
+  {1, 1, 1, 0, 1, 1, 1, 1, 1, 2, 3, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0};
+
+//create new type named INSTRUCTION
+typedef struct instructiontype
+{
+   int op;
+   int a, b;            // addresses or constants
+   int target;          // code index for jumps
+   char *opnd;          // operand text until resolved
+   int line;            // line in .a file, for messages
+} INSTRUCTION;
+
+//create new type named LABEL for the label hash table
+typedef struct labeltype
+{
+   char *name;
+   int isCode;          // TRUE if it labels an instruction
+   int address;         // code index or data address
+   struct labeltype *next;
+} LABEL;
+
+INSTRUCTION *code;
+int codex, codeSize;         // instruction count, allocated size
+int *mem;                    // data memory
+int memx, memSize;
+LABEL *labels[HASHSIZE];
+char **pending;              // labels waiting for their line
+int pendingx, pendingSize;
+
+int *stack;                  // operand stack
+int stackSize;
+int declaredStack = -1;      // from ;#stack, -1 if none
+int verified;                // TRUE if verifyStack passed
+long dispatches[NUMOPS];     // executions of each opcode
+int stats = FALSE;
+int interp = FALSE;          // TRUE for --interp: no JIT
+char *fileName;
+int lineNumber;
+
+//-----------------------------------------
+void fail(char *message, char *detail)
+{
+   fprintf(stderr, "%s line %d: %s %s\n", fileName, lineNumber,
+      message, detail);
+   exit(1);
+}
+//-----------------------------------------
+unsigned hash(char *s)
+{
+   unsigned h = 5381;
+   while (*s)
+      h = h * 33 + (unsigned char)*s++;
+   return h % HASHSIZE;
+}
+//-----------------------------------------
+LABEL *lookup(char *name)
+{
+   LABEL *l;
+   for (l = labels[hash(name)]; l; l = l -> next)
+      if (!strcmp(l -> name, name))
+         return l;
+   return NULL;
+}
+//-----------------------------------------
+void defineLabel(char *name, int isCode, int address)
+{
+   LABEL *l;
+   unsigned h;
+
+   if (lookup(name))
+      fail("duplicate label", name);
+   h = hash(name);
+   l = (LABEL *)malloc(sizeof(LABEL));
+   l -> name = strdup(name);
+   l -> isCode = isCode;
+   l -> address = address;
+   l -> next = labels[h];
+   labels[h] = l;
+}
+//-----------------------------------------
+// hold a label from a line of its own until the next line
+void addPending(char *name)
+{
+   if (pendingx == pendingSize)
+   {
+      pendingSize = pendingSize ? 2 * pendingSize : 16;
+      pending = (char **)realloc(pending, pendingSize * sizeof(char *));
+   }
+   pending[pendingx++] = strdup(name);
+}
+//-----------------------------------------
+// define the held labels at address
+void definePending(int isCode, int address)
+{
+   while (pendingx > 0)
+   {
+      pendingx--;
+      defineLabel(pending[pendingx], isCode, address);
+      free(pending[pendingx]);
+   }
+}
+//-----------------------------------------
+// allocate one word of data memory, return its address
+int allocWord(int value)
+{
+   if (memx == memSize)
+   {
+      memSize = memSize ? 2 * memSize : 1024;
+      mem = (int *)realloc(mem, memSize * sizeof(int));
+   }
+   mem[memx] = value;
+   return memx++;
+}
+//-----------------------------------------
+// dw value: a number or a "string", stored one char per word
+int defineData(char *value)
+{
+   int address;
+   char *s;
+
+   if (*value != '"')
+      return allocWord(atoi(value));
+
+   address = memx;
+   for (s = value + 1; *s && *s != '"'; s++)
+      allocWord((unsigned char)*s);
+   allocWord(0);
+   return address;
+}
+//-----------------------------------------
+INSTRUCTION *newInstruction(void)
+{
+   if (codex == codeSize)
+   {
+      codeSize = codeSize ? 2 * codeSize : 1024;
+      code = (INSTRUCTION *)realloc(code,
+         codeSize * sizeof(INSTRUCTION));
+   }
+   memset(&code[codex], 0, sizeof(INSTRUCTION));
+   code[codex].line = lineNumber;
+   return &code[codex++];
+}
+//-----------------------------------------
+// strip trailing whitespace in place
+void trim(char *s)
+{
+   int n = strlen(s);
+   while (n > 0 && isspace((unsigned char)s[n - 1]))
+      s[--n] = '\0';
+}
+//-----------------------------------------
+// read the .a file into code, mem, and the label table
+void load(FILE *f)
+{
+   char line[MAX], name[MAX], op[MAX];
+   char *s, *colon;
+   int i, n, address;
+   INSTRUCTION *in;
+
+   while (fgets(line, sizeof(line), f))
+   {
+      lineNumber++;
+      trim(line);
+      if (!strncmp(line, ";#stack", 7))
+         sscanf(line + 7, "%d", &declaredStack);
+      if (line[0] == ';' || line[0] == '\0')
+         continue;
+
+      s = line;
+      if (!isspace((unsigned char)line[0]))   // label field
+      {
+         colon = strchr(line, ':');
+         if (!colon)
+            fail("missing colon after label", line);
+         *colon = '\0';
+         // ^label: dw "string" defines label
+         strcpy(name, line[0] == '^' ? line + 1 : line);
+         s = colon + 1;
+         while (isspace((unsigned char)*s))
+            s++;
+         if (!strncmp(s, "dw", 2) && (s[2] == '\0' ||
+            isspace((unsigned char)s[2])))
+         {
+            s += 2;
+            while (isspace((unsigned char)*s))
+               s++;
+            address = defineData(s);
+            definePending(FALSE, address);
+            defineLabel(name, FALSE, address);
+            continue;
+         }
+         if (*s == '\0')
+         {
+            addPending(name);
+            continue;
+         }
+         defineLabel(name, TRUE, codex);
+      }
+
+      while (isspace((unsigned char)*s))
+         s++;
+      n = 0;
+      while (*s && !isspace((unsigned char)*s))
+         op[n++] = *s++;
+      op[n] = '\0';
+      while (isspace((unsigned char)*s))
+         s++;
+
+      for (i = 0; i < NUMOPS; i++)
+         if (!strcmp(op, opName[i]))
+            break;
+      if (i == NUMOPS)
+         fail("unknown instruction", op);
+      definePending(TRUE, codex);
+      in = newInstruction();
+      in -> op = i;
+      in -> opnd = strdup(s);
+   }
+   definePending(TRUE, codex);     // labels at the end of the code
+}
+//-----------------------------------------
+// address of data label name
+int dataAddress(char *name)
+{
+   LABEL *l = lookup(name);
+   if (!l || l -> isCode)
+      fail("undefined variable", name);
+   return l -> address;
+}
+//-----------------------------------------
+// code index of code label name
+int codeAddress(char *name)
+{
+   LABEL *l = lookup(name);
+   if (!l || !l -> isCode)
+      fail("undefined label", name);
+   return l -> address;
+}
+//-----------------------------------------
+// value of a char constant like 'a' or '\n'
+int charConstant(char *s)
+{
+   if (s[1] != '\\')
+      return (unsigned char)s[1];
+   switch (s[2])
+   {
+      case 'n':
+         return '\n';
+      case 't':
+         return '\t';
+      case '0':
+         return '\0';
+      default:
+         return (unsigned char)s[2];
+   }
+}
+//-----------------------------------------
+// split "x,y,z" operand text into up to 3 fields in place
+int split(char *s, char *field[3])
+{
+   int n = 0;
+   field[n++] = s;
+   while (*s && n < 3)
+   {
+      if (*s == ',')
+      {
+         *s = '\0';
+         field[n++] = s + 1;
+      }
+      s++;
+   }
+   return n;
+}
+//-----------------------------------------
+// turn operand text into addresses and constants
+void resolve(void)
+{
+   int i, n;
+   char *field[3];
+   INSTRUCTION *in;
+
+   for (i = 0; i < codex; i++)
+   {
+      in = &code[i];
+      lineNumber = in -> line;
+      n = split(in -> opnd, field);
+      switch (in -> op)
+      {
+         case PWC:
+            in -> a = atoi(field[0]);
+            break;
+         case PC:
+            if (field[0][0] == '\'')
+               in -> a = charConstant(field[0]);
+            else
+               in -> a = dataAddress(field[0]);
+            break;
+         case P:
+         case INC:
+         case DEC:
+         case STK:
+            in -> a = dataAddress(field[0]);
+            break;
+         case JZ:
+         case JA:
+            in -> target = codeAddress(field[0]);
+            break;
+         case ADDI:
+            if (n != 2)
+               fail("expecting x,n after", opName[in -> op]);
+            in -> a = dataAddress(field[0]);
+            in -> b = atoi(field[1]);
+            break;
+         case SWAP:
+            if (n != 2)
+               fail("expecting x,y after", opName[in -> op]);
+            in -> a = dataAddress(field[0]);
+            in -> b = dataAddress(field[1]);
+            break;
+         case JEQ:
+            if (n != 3)
+               fail("expecting x,n,L after", opName[in -> op]);
+            in -> a = dataAddress(field[0]);
+            in -> b = atoi(field[1]);
+            in -> target = codeAddress(field[2]);
+            break;
+      }
+   }
+}
+//-----------------------------------------
+// Work out the operand stack depth before each instruction by
+// following every path through the code.  Returns the most
+// entries the stack ever holds, or -1 if some path pops an empty
+// stack or two paths reach an instruction at different depths.
+int verifyStack(void)
+{
+   int *depth, *work, workx = 0;
+   int i, j, d, n, maxDepth = 0;
+   int next[2];
+   INSTRUCTION *in;
+
+   depth = (int *)malloc((codex + 1) * sizeof(int));
+   work = (int *)malloc((codex + 1) * sizeof(int));
+   for (i = 0; i <= codex; i++)
+      depth[i] = -1;
+   depth[0] = 0;
+   work[workx++] = 0;
+
+   while (workx > 0 && maxDepth >= 0)
+   {
+      i = work[--workx];
+      if (i == codex)             // ran off the end; run reports it
+         continue;
+      in = &code[i];
+      d = depth[i];
+      if (d < stackIn[in -> op])
+      {
+         maxDepth = -1;
+         break;
+      }
+      d += stackOut[in -> op] - stackIn[in -> op];
+      if (d > maxDepth)
+         maxDepth = d;
+
+      n = 0;
+      if (in -> op == JZ || in -> op == JA || in -> op == JEQ)
+         next[n++] = in -> target;
+      if (in -> op != JA && in -> op != HALT)
+         next[n++] = i + 1;
+      for (j = 0; j < n; j++)
+         if (depth[next[j]] < 0)
+         {
+            depth[next[j]] = d;
+            work[workx++] = next[j];
+         }
+         else if (depth[next[j]] != d)
+            maxDepth = -1;
+   }
+   free(depth);
+   free(work);
+   return maxDepth;
+}
+//-----------------------------------------
+// Run the loaded program from its first instruction.  Once the
+// stack use is verified, the stack cannot overflow or underflow,
+// so the checks for that are skipped.
+void run(void)
+{
+   int pc = 0, sp = 0;
+   int left, right, t;
+   INSTRUCTION *in;
+
+   while (TRUE)
+   {
+      if (pc >= codex)
+      {
+         fprintf(stderr, "Ran off end of code without halt\n");
+         exit(1);
+      }
+      in = &code[pc++];
+      dispatches[in -> op]++;
+      if (!verified && sp >= stackSize - 1)
+      {
+         fprintf(stderr, "Stack overflow\n");
+         exit(1);
+      }
+      switch (in -> op)
+      {
+         case PWC:
+         case PC:
+            stack[sp++] = in -> a;
+            break;
+         case P:
+            stack[sp++] = mem[in -> a];
+            break;
+         case STAV:
+            t = stack[--sp];
+            mem[stack[--sp]] = t;
+            break;
+         case ADD:
+         case SUB:
+         case MULT:
+         case DIV:
+            right = stack[--sp];
+            left = stack[--sp];
+            switch (in -> op)
+            {
+               case ADD:
+                  t = (int)((unsigned)left + (unsigned)right);
+                  break;
+               case SUB:
+                  t = (int)((unsigned)left - (unsigned)right);
+                  break;
+               case MULT:
+                  t = (int)((unsigned)left * (unsigned)right);
+                  break;
+               default:
+                  if (right == 0)
+                  {
+                     fprintf(stderr, "Division by zero\n");
+                     exit(1);
+                  }
+                  t = right == -1 ? (int)(0u - (unsigned)left)
+                     : left / right;
+                  break;
+            }
+            stack[sp++] = t;
+            break;
+         case NEG:
+            stack[sp - 1] = (int)(0u - (unsigned)stack[sp - 1]);
+            break;
+         case DUPE:
+            stack[sp] = stack[sp - 1];
+            sp++;
+            break;
+         case ROT:
+            t = stack[sp - 1];
+            stack[sp - 1] = stack[sp - 2];
+            stack[sp - 2] = stack[sp - 3];
+            stack[sp - 3] = t;
+            break;
+         case JZ:
+            if (stack[--sp] == 0)
+               pc = in -> target;
+            break;
+         case JA:
+            pc = in -> target;
+            break;
+         case DIN:
+            if (scanf("%d", &t) != 1)
+               t = 0;
+            stack[sp++] = t;
+            break;
+         case DOUT:
+            printf("%d", stack[--sp]);
+            break;
+         case AOUT:
+            putchar(stack[--sp]);
+            break;
+         case SOUT:
+            for (t = stack[--sp]; mem[t]; t++)
+               putchar(mem[t]);
+            break;
+         case HALT:
+            return;
+         case INC:
+            mem[in -> a] = (int)((unsigned)mem[in -> a] + 1u);
+            break;
+         case DEC:
+            mem[in -> a] = (int)((unsigned)mem[in -> a] - 1u);
+            break;
+         case ADDI:
+            mem[in -> a] = (int)((unsigned)mem[in -> a] +
+               (unsigned)in -> b);
+            break;
+         case STK:
+            mem[in -> a] = stack[sp - 1];
+            break;
+         case JEQ:
+            if (mem[in -> a] == in -> b)
+               pc = in -> target;
+            break;
+         case SWAP:
+            t = mem[in -> a];
+            mem[in -> a] = mem[in -> b];
+            mem[in -> b] = t;
+            break;
+      }
+      if (!verified && sp < 0)
+      {
+         fprintf(stderr, "Stack underflow\n");
+         exit(1);
+      }
+   }
+}
+#if defined(__x86_64__)
+//-----------------------------------------
+// JIT for x86-64
+//
+// Each instruction becomes a short run of native code.  Register
+// use in the generated code:
+//   rbx   base of mem, so variable x is [rbx + 4*x]
+//   r12   operand stack pointer (next free int)
+//   r13d  top of the operand stack, when cached
+// The top of stack is cached in r13d between pushes and pops and
+// spilled to memory before jumps and at jump targets, where the
+// stack is always wholly in memory.  I/O goes through the jit
+// helper functions, which leave rbx, r12, and r13 alone.
+
+// generated code is called as jitCode(mem, stack)
+typedef void (*JITCODE)(int *, int *);
+
+unsigned char *jitBuffer;    // native code
+int jitx, jitSize;           // bytes used, allocated
+int *jitOffset;              // native offset of each instruction
+int *jitFixup;               // rel32 fields to patch with...
+int *jitFixupTarget;         // ...the offset of this instruction
+int jitFixupx;
+int cached;                  // TRUE if top of stack is in r13d
+
+//-----------------------------------------
+// I/O helpers called from the generated code
+int jitDin(void)
+{
+   int t;
+   if (scanf("%d", &t) != 1)
+      t = 0;
+   return t;
+}
+void jitDout(int v)
+{
+   printf("%d", v);
+}
+void jitAout(int c)
+{
+   putchar(c);
+}
+void jitSout(int address)
+{
+   for (; mem[address]; address++)
+      putchar(mem[address]);
+}
+void jitDivZero(void)
+{
+   fprintf(stderr, "Division by zero\n");
+   exit(1);
+}
+void jitRanOff(void)
+{
+   fprintf(stderr, "Ran off end of code without halt\n");
+   exit(1);
+}
+//-----------------------------------------
+// emit n bytes of code
+void jitBytes(int n, ...)
+{
+   va_list args;
+   va_start(args, n);
+   while (n-- > 0)
+      jitBuffer[jitx++] = (unsigned char)va_arg(args, int);
+   va_end(args);
+}
+//-----------------------------------------
+void jit32(int v)
+{
+   memcpy(&jitBuffer[jitx], &v, 4);
+   jitx += 4;
+}
+//-----------------------------------------
+// emit a rel32 jump field to code index target, patched later
+void jitRel32(int target)
+{
+   jitFixup[jitFixupx] = jitx;
+   jitFixupTarget[jitFixupx++] = target;
+   jit32(0);
+}
+//-----------------------------------------
+// emit call to helper function f
+void jitCall(void *f)
+{
+   jitBytes(2, 0x48, 0xB8);            // mov rax, f
+   memcpy(&jitBuffer[jitx], &f, 8);
+   jitx += 8;
+   jitBytes(2, 0xFF, 0xD0);            // call rax
+}
+//-----------------------------------------
+// move the cached top of stack to the memory stack
+void jitSpill(void)
+{
+   if (!cached)
+      return;
+   jitBytes(4, 0x45, 0x89, 0x2C, 0x24);   // mov [r12], r13d
+   jitBytes(4, 0x49, 0x83, 0xC4, 0x04);   // add r12, 4
+   cached = FALSE;
+}
+//-----------------------------------------
+// make sure the top of stack is in r13d
+void jitFill(void)
+{
+   if (cached)
+      return;
+   jitBytes(4, 0x49, 0x83, 0xEC, 0x04);   // sub r12, 4
+   jitBytes(4, 0x45, 0x8B, 0x2C, 0x24);   // mov r13d, [r12]
+   cached = TRUE;
+}
+//-----------------------------------------
+// pop the entry below the cached top of stack into eax
+void jitPopEax(void)
+{
+   jitBytes(4, 0x49, 0x83, 0xEC, 0x04);   // sub r12, 4
+   jitBytes(4, 0x41, 0x8B, 0x04, 0x24);   // mov eax, [r12]
+}
+//-----------------------------------------
+// Translate code into native code.  Returns NULL if the code
+// cannot be made executable.
+JITCODE jitCompile(void)
+{
+   int i, rel, divZero;
+   char *isTarget;
+   INSTRUCTION *in;
+
+   jitSize = codex * 64 + 256;
+   jitBuffer = mmap(NULL, jitSize, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (jitBuffer == MAP_FAILED)
+      return NULL;
+   jitOffset = (int *)malloc((codex + 2) * sizeof(int));
+   jitFixup = (int *)malloc((2 * codex + 1) * sizeof(int));
+   jitFixupTarget = (int *)malloc((2 * codex + 1) * sizeof(int));
+   isTarget = (char *)calloc(codex + 1, 1);
+   for (i = 0; i < codex; i++)
+      if (code[i].op == JZ || code[i].op == JA || code[i].op == JEQ)
+         isTarget[code[i].target] = TRUE;
+
+   // prologue: save registers, rbx = mem, r12 = stack
+   jitBytes(5, 0x53, 0x41, 0x54, 0x41, 0x55);   // push rbx, r12, r13
+   jitBytes(3, 0x48, 0x89, 0xFB);               // mov rbx, rdi
+   jitBytes(3, 0x49, 0x89, 0xF4);               // mov r12, rsi
+   cached = FALSE;
+
+   // Running off the end falls into a stub at code index codex.
+   // The division by zero check jumps to one at codex + 1.
+   divZero = codex + 1;
+   for (i = 0; i < codex; i++)
+   {
+      in = &code[i];
+      if (isTarget[i])
+         jitSpill();
+      jitOffset[i] = jitx;
+      switch (in -> op)
+      {
+         case PWC:
+         case PC:
+            jitSpill();
+            jitBytes(2, 0x41, 0xBD);             // mov r13d, a
+            jit32(in -> a);
+            cached = TRUE;
+            break;
+         case P:
+            jitSpill();
+            jitBytes(3, 0x44, 0x8B, 0xAB);       // mov r13d, [rbx+4a]
+            jit32(4 * in -> a);
+            cached = TRUE;
+            break;
+         case STAV:
+            jitFill();
+            jitPopEax();
+            jitBytes(4, 0x44, 0x89, 0x2C, 0x83); // mov [rbx+4*rax], r13d
+            cached = FALSE;
+            break;
+         case ADD:
+         case SUB:
+         case MULT:
+            jitFill();
+            jitPopEax();
+            if (in -> op == ADD)
+               jitBytes(3, 0x44, 0x01, 0xE8);    // add eax, r13d
+            else if (in -> op == SUB)
+               jitBytes(3, 0x44, 0x29, 0xE8);    // sub eax, r13d
+            else
+               jitBytes(4, 0x41, 0x0F, 0xAF, 0xC5);  // imul eax, r13d
+            jitBytes(3, 0x41, 0x89, 0xC5);       // mov r13d, eax
+            break;
+         case DIV:
+            jitFill();
+            jitPopEax();
+            jitBytes(3, 0x45, 0x85, 0xED);       // test r13d, r13d
+            jitBytes(2, 0x0F, 0x84);             // jz divZero
+            jitRel32(divZero);
+            jitBytes(4, 0x41, 0x83, 0xFD, 0xFF); // cmp r13d, -1
+            jitBytes(2, 0x75, 0x04);             // jne idiv
+            jitBytes(2, 0xF7, 0xD8);             // neg eax
+            jitBytes(2, 0xEB, 0x04);             // jmp done
+            jitBytes(1, 0x99);                   // idiv: cdq
+            jitBytes(3, 0x41, 0xF7, 0xFD);       // idiv r13d
+            jitBytes(3, 0x41, 0x89, 0xC5);       // done: mov r13d, eax
+            break;
+         case NEG:
+            jitFill();
+            jitBytes(3, 0x41, 0xF7, 0xDD);       // neg r13d
+            break;
+         case DUPE:
+            jitFill();
+            jitSpill();                          // copy stays in r13d
+            cached = TRUE;
+            break;
+         case ROT:
+            jitFill();
+            jitBytes(5, 0x41, 0x8B, 0x44, 0x24, 0xF8);  // mov eax, [r12-8]
+            jitBytes(5, 0x41, 0x8B, 0x4C, 0x24, 0xFC);  // mov ecx, [r12-4]
+            jitBytes(5, 0x45, 0x89, 0x6C, 0x24, 0xF8);  // mov [r12-8], r13d
+            jitBytes(5, 0x41, 0x89, 0x44, 0x24, 0xFC);  // mov [r12-4], eax
+            jitBytes(3, 0x41, 0x89, 0xCD);       // mov r13d, ecx
+            break;
+         case JZ:
+            jitFill();
+            jitBytes(3, 0x45, 0x85, 0xED);       // test r13d, r13d
+            cached = FALSE;
+            jitBytes(2, 0x0F, 0x84);             // jz target
+            jitRel32(in -> target);
+            break;
+         case JA:
+            jitSpill();
+            jitBytes(1, 0xE9);                   // jmp target
+            jitRel32(in -> target);
+            break;
+         case DIN:
+            jitSpill();
+            jitCall(jitDin);
+            jitBytes(3, 0x41, 0x89, 0xC5);       // mov r13d, eax
+            cached = TRUE;
+            break;
+         case DOUT:
+         case AOUT:
+         case SOUT:
+            jitFill();
+            jitBytes(3, 0x44, 0x89, 0xEF);       // mov edi, r13d
+            cached = FALSE;
+            jitCall(in -> op == DOUT ? (void *)jitDout :
+               in -> op == AOUT ? (void *)jitAout : (void *)jitSout);
+            break;
+         case HALT:
+            jitBytes(6, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3);  // pop, ret
+            cached = FALSE;
+            break;
+         case INC:
+         case DEC:
+         case ADDI:
+            jitBytes(2, 0x81, 0x83);             // add [rbx+4a], n
+            jit32(4 * in -> a);
+            jit32(in -> op == INC ? 1 : in -> op == DEC ? -1 : in -> b);
+            break;
+         case STK:
+            jitFill();
+            jitBytes(3, 0x44, 0x89, 0xAB);       // mov [rbx+4a], r13d
+            jit32(4 * in -> a);
+            break;
+         case JEQ:
+            jitSpill();
+            jitBytes(2, 0x81, 0xBB);             // cmp [rbx+4a], b
+            jit32(4 * in -> a);
+            jit32(in -> b);
+            jitBytes(2, 0x0F, 0x84);             // je target
+            jitRel32(in -> target);
+            break;
+         case SWAP:
+            jitBytes(2, 0x8B, 0x83);             // mov eax, [rbx+4a]
+            jit32(4 * in -> a);
+            jitBytes(2, 0x8B, 0x8B);             // mov ecx, [rbx+4b]
+            jit32(4 * in -> b);
+            jitBytes(2, 0x89, 0x8B);             // mov [rbx+4a], ecx
+            jit32(4 * in -> a);
+            jitBytes(2, 0x89, 0x83);             // mov [rbx+4b], eax
+            jit32(4 * in -> b);
+            break;
+      }
+   }
+
+   // stubs for running off the end and division by zero
+   jitSpill();
+   jitOffset[codex] = jitx;
+   jitCall(jitRanOff);
+   jitOffset[divZero] = jitx;
+   jitCall(jitDivZero);
+
+   for (i = 0; i < jitFixupx; i++)
+   {
+      rel = jitOffset[jitFixupTarget[i]] - (jitFixup[i] + 4);
+      memcpy(&jitBuffer[jitFixup[i]], &rel, 4);
+   }
+   free(isTarget);
+
+   if (mprotect(jitBuffer, jitSize, PROT_READ | PROT_EXEC))
+      return NULL;
+   return (JITCODE)jitBuffer;
+}
+#endif
+//-----------------------------------------
+// print the dispatch counts to stderr
+void printStats(void)
+{
+   int i;
+   long total = 0;
+
+   for (i = 0; i < NUMOPS; i++)
+      total += dispatches[i];
+   fprintf(stderr, "dispatches %ld\n", total);
+   for (i = 0; i < NUMOPS; i++)
+      if (dispatches[i])
+         fprintf(stderr, "  %-4s %ld\n", opName[i], dispatches[i]);
+}
+//-----------------------------------------
+// Usage: DRInterp [--stats] [--interp] <file.a>
+// --stats prints the number of instructions dispatched, in total
+// and per opcode, to stderr after the program halts.  Counting
+// needs the interpreter, so --stats implies --interp.
+// --interp runs the interpreter instead of the JIT, for example
+// to compare the two in differential tests.
+int main(int argc, char *argv[])
+{
+   FILE *f;
+   int i, n;
+
+   for (i = 1; i < argc - 1; i++)
+   {
+      if (!strcmp(argv[i], "--stats"))
+         stats = TRUE;
+      else if (!strcmp(argv[i], "--interp"))
+         interp = TRUE;
+      else
+      {
+         fprintf(stderr, "%s is not a valid argument\n", argv[i]);
+         exit(1);
+      }
+   }
+   if (argc < 2)
+   {
+      fprintf(stderr, "Usage: DRInterp [--stats] [--interp] file.a\n");
+      exit(1);
+   }
+
+   fileName = argv[argc - 1];
+   f = fopen(fileName, "r");
+   if (!f)
+   {
+      fprintf(stderr, "Error: Cannot open %s\n", fileName);
+      exit(1);
+   }
+   load(f);
+   fclose(f);
+   resolve();
+
+   // A ;#stack directive is only trusted if the code fits it.
+   // Without one, verified code gets just the stack it needs.
+   n = verifyStack();
+   verified = n >= 0;
+   if (declaredStack >= 0 && (!verified || n > declaredStack))
+   {
+      fprintf(stderr, "%s: code does not fit its ;#stack %d\n",
+         fileName, declaredStack);
+      exit(1);
+   }
+   if (!verified)
+      stackSize = STACKSIZE;
+   else
+      stackSize = (declaredStack >= 0 ? declaredStack : n) + 1;
+   stack = (int *)malloc(stackSize * sizeof(int));
+
+   // the JIT has no stack checks, so it needs verified code
+#if defined(__x86_64__)
+   if (!stats && !interp && verified)
+   {
+      JITCODE jitCode = jitCompile();
+      if (jitCode)
+      {
+         jitCode(mem, stack);
+         fflush(stdout);
+         return 0;
+      }
+   }
+#endif
+   run();
+   fflush(stdout);
+   if (stats)
+      printStats();
+   return 0;
+}